@@ -6,20 +6,131 @@
 #include <cassert>
 #include <functional>
 #include <complex>
+#include <array>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <tuple>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <cctype>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <mutex>
+#include <sys/syscall.h>
+#include <memory_resource>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
 
 const long double PI = std::acos(-1.0L);
 
+// Источник памяти для цифр длинных чисел в текущем потоке (по умолчанию - обычные new/delete):
+std::pmr::memory_resource*& limb_resource();
+
+// Арена на время вычисления: пока объект существует, цифры новых длинных чисел этого потока берутся
+// из пула, который запрашивает память у системы крупными кусками и переиспользует освободившиеся блоки.
+// Число, созданное внутри области, нельзя выносить за её пределы: результат нужно присвоить объекту,
+// созданному до начала области (при присваивании между разными источниками цифры копируются).
+// Правило проверяется: к концу области вся выданная ареной память должна вернуться, а число может
+// расти только за счёт источника, который ещё жив в текущем потоке (is_live).
+struct LimbArena : std::pmr::memory_resource {
+    static const size_t LARGEST_BLOCK = 1 << 20; // Более крупные блоки запрашиваются у системы напрямую
+
+    LimbArena();
+    ~LimbArena();
+    LimbArena(const LimbArena&) = delete;
+    LimbArena& operator=(const LimbArena&) = delete;
+
+    // resource - new_delete_resource() или арена текущего потока, область которой ещё не закончилась:
+    static bool is_live(const std::pmr::memory_resource* resource);
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+    std::pmr::unsynchronized_pool_resource pool;
+    std::pmr::memory_resource* previous;
+    size_t outstanding = 0; // Выданная и ещё не возвращённая память
+};
+
+// Хранилище цифр длинного числа: первые INLINE цифр лежат внутри самого объекта,
+// и только более длинные числа переносятся в динамическую память (из limb_resource()). Числа по модулю
+// до ~10^36 (весь цикл шифрования с 64-битным prime) так и не обращаются к аллокатору.
+struct LimbVector {
+    static const int64_t INLINE = 4;
+
+    LimbVector() = default;
+    explicit LimbVector(std::pmr::memory_resource* resource) : resource(resource) {}
+    explicit LimbVector(int64_t size, int64_t value = 0);
+    LimbVector(const int64_t* begin, const int64_t* end);
+    LimbVector(const LimbVector& other);
+    LimbVector(LimbVector&& other) noexcept;
+    LimbVector& operator=(const LimbVector& other);
+    LimbVector& operator=(LimbVector&& other) noexcept;
+    ~LimbVector() { release(); }
+
+    int64_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    bool is_inline() const { return ptr == storage; }
+    int64_t* data() { return ptr; }
+    const int64_t* data() const { return ptr; }
+    int64_t* begin() { return ptr; }
+    int64_t* end() { return ptr + count; }
+    const int64_t* begin() const { return ptr; }
+    const int64_t* end() const { return ptr + count; }
+    int64_t& operator[](int64_t i) { return ptr[i]; }
+    const int64_t& operator[](int64_t i) const { return ptr[i]; }
+    int64_t& back() { return ptr[count-1]; }
+    const int64_t& back() const { return ptr[count-1]; }
+
+    void reserve(int64_t n) { if (n > capacity) grow(n); }
+    void resize(int64_t n, int64_t value = 0);
+    void push_back(int64_t value) {
+        if (count == capacity) grow(2 * capacity);
+        ptr[count++] = value;
+    }
+    void pop_back() { --count; }
+    void clear() { count = 0; }
+
+private:
+    int64_t* ptr = storage;
+    int64_t count = 0;
+    int64_t capacity = INLINE;
+    std::pmr::memory_resource* resource = limb_resource(); // Откуда взят динамический буфер
+    int64_t storage[INLINE];
+
+    void grow(int64_t n); // Перенос в динамическую память вместимостью не меньше n
+    void release();
+};
+
+struct UIntProduct;
+struct UIntScaled;
+
 struct UInt {
     static const int64_t BASE = (int64_t)1e9; // Основание системы счисления
     static const int64_t WIDTH = 9;       // Количество десятичных цифр, которые хранятся в одной цифре
+    static const int64_t KARATSUBA_THRESHOLD = 64; // Начиная с этой длины меньшего множителя - умножение Карацубы
+    static const int64_t FFT_THRESHOLD = 512;      // Начиная с этой длины меньшего множителя - преобразование Фурье
+    static const int64_t FFT_MAX_LENGTH = 1 << 22; // Наибольшая суммарная длина множителей для преобразования Фурье
+    static const int64_t NEWTON_THRESHOLD = 256;  // Начиная с этой длины делителя деление выполняется методом Ньютона
+    static const int64_t NEWTON_LEAF = 64;        // Длина, на которой рекурсия вычисления обратного заканчивается
 
-    // Вектор под цифры числа:
-    std::vector<int64_t> digits;
+    // Цифры числа, начиная с младшей:
+    LimbVector digits;
 
     // Конструкторы
     UInt(int64_t number = 0);
-    UInt(const std::string& s);
+    UInt(const std::string& s); // Бросает std::invalid_argument, если s - не десятичное число
     UInt(const std::vector<int64_t>& digits);
+    UInt(LimbVector digits);
 
     // Методы нормализации и сравнения:
     UInt& normalize(); // удаление лидирующих нулей и проверка на принадлежность цифр диапазону [0, BASE)
@@ -28,14 +139,25 @@ struct UInt {
     // Методы умножения:
     UInt slow_mult(const UInt& other) const; // Медленное произведение (работает довольно быстро на числах небольшой длины)
     UInt fast_mult(const UInt& other) const; // Быстрое произведение (на основе Быстрого Преобразования Фурье комплексные числа)
+    UInt karatsuba_mult(const UInt& other) const; // Произведение методом Карацубы (для средних длин)
     UInt mult(const UInt& other) const; // Комбинированный метод умножения на основе экспериментальных данных
+    static bool fast_mult_pays(int64_t len1, int64_t len2); // Выбор метода умножения по длинам множителей
 
-    // Метод деления:
+    // Методы деления:
     std::pair<UInt, UInt> div_mod(const UInt& other) const; // Целая часть и остаток от деления
+    std::pair<UInt, UInt> newton_div_mod(const UInt& other) const; // То же через приближение обратного (для длинных делителей)
+    std::pair<UInt, UInt> div_mod(const UInt& other, const UInt& inv) const; // То же при известном inv = other.reciprocal()
+    UInt reciprocal() const; // Целая часть BASE^(2n) / *this, где n - количество цифр
+
+    // Сдвиги на целое число цифр:
+    UInt shifted(int64_t n) const; // *this * BASE^n при n >= 0 и *this / BASE^(-n) при n < 0
+    UInt low_digits(int64_t n) const; // *this % BASE^n
 
     // Операторы:
     UInt& operator+=(const int64_t num);     // Прибавление короткого
     UInt& operator+=(const UInt& other); // Прибавление длинного
+    UInt& operator+=(const UIntProduct& product); // Прибавление произведения без его вычисления отдельно
+    UInt& operator+=(const UIntScaled& product);  // То же для произведения на короткое
     UInt& operator-=(const int64_t num);     // Вычитание короткого
     UInt& operator-=(const UInt& other); // Вычитание длинного
     UInt& operator*=(const int64_t num);     // Умножение на короткое
@@ -49,22 +171,103 @@ std::istream& operator>>(std::istream&, UInt&); // Ввод из потока
 std::ostream& operator<<(std::ostream&, const UInt&); // Вывод в поток
 
 UInt pow(UInt, int64_t); // Возведение в степень
-UInt gcd(UInt, UInt); // Наибольший общий делитель
+UInt gcd(const UInt&, const UInt&); // Наибольший общий делитель
+uint64_t binary_gcd(uint64_t, uint64_t); // То же для коротких чисел
+UInt xgcd(const UInt& x, const UInt& y, UInt& s, UInt& t); // НОД g = s * x - t * y, где 0 <= s <= y/g, 0 <= t <= x/g (x > 0)
+UInt invmod(const UInt& a, const UInt& m); // a^(-1) mod m или 0, если a не обратимо по модулю m
+
+// Десятичные преобразования без выделения памяти, по 8 цифр за раз в одном 64-битном регистре (SWAR):
+uint64_t parse8(const char* s); // Ровно 8 цифр -> число
+bool all_digits8(const char* s); // Все 8 байт - цифры
+void format8(char* out, uint32_t value); // value < 10^8 -> ровно 8 цифр с ведущими нулями
+char* format_u64(char* out, uint64_t value); // Запись числа, возвращает конец (после out должно быть 28 байт)
+const char* parse_u64(const char* begin, const char* end, uint64_t& value); // Разбор числа, возвращает конец
+                                                                             // (begin, если числа нет или оно не меньше 2^64)
+bool is_decimal(const std::string& s); // Непустая строка из одних цифр
+void append_u64(std::string& out, uint64_t value); // Дописать число в строку
+void append_uint(std::string& out, const UInt& number); // Дописать длинное число в строку
+
+UInt from_digits(const std::vector<int64_t>& digits, int64_t radix); // Число по его цифрам в системе по основанию radix
+template <typename Digit>
+UInt from_digits(int64_t size, int64_t radix, const Digit& digit); // То же, i-я цифра равна digit(i)
+std::vector<int64_t> to_digits(const UInt& number, int64_t radix, int64_t count = 0); // Цифры числа по основанию radix
+
+// Ленивые произведения: a * b и a * k (k - короткое) только запоминают ссылки на множители.
+// Если за произведением сразу следует + c, += или % m, выполняется слитное ядро (addmul, mulmod),
+// которое не создаёт промежуточного произведения; в остальных случаях произведение вычисляется
+// при преобразовании в UInt. Ссылки действительны до конца полного выражения, поэтому
+// произведение нельзя сохранять в auto-переменную.
+struct UIntProduct {
+    const UInt& a;
+    const UInt& b;
+
+    operator UInt() const { return a.mult(b); }
+    UInt shifted(int64_t n) const { return a.mult(b).shifted(n); }
+    UInt low_digits(int64_t n) const { return a.mult(b).low_digits(n); }
+};
+
+struct UIntScaled {
+    const UInt& a;
+    int64_t k;
+
+    operator UInt() const;
+};
 
 UInt operator+(const UInt&, const UInt&);
 UInt operator-(const UInt&, const UInt&);
-UInt operator*(const UInt&, const UInt&);
+UIntProduct operator*(const UInt&, const UInt&);
 UInt operator/(const UInt&, const UInt&);
 UInt operator%(const UInt&, const UInt&);
 
 UInt operator+(const UInt&, const int64_t);
 UInt operator+(const int64_t, const UInt&);
 UInt operator-(const UInt&, const int64_t);
-UInt operator*(const UInt&, const int64_t);
-UInt operator*(const int64_t, const UInt&);
+UIntScaled operator*(const UInt&, const int64_t);
+UIntScaled operator*(const int64_t, const UInt&);
 UInt operator/(const UInt&, const int64_t);
+
+// Слитные ядра для ленивых произведений:
+UInt operator+(const UInt&, const UIntProduct&);  // c + a * b
+UInt operator+(const UIntProduct&, const UInt&);
+UInt operator+(UInt&&, const UIntProduct&);
+UInt operator+(const UInt&, const UIntScaled&);   // c + a * k
+UInt operator+(const UIntScaled&, const UInt&);
+UInt operator+(UInt&&, const UIntScaled&);
+UInt operator+(const UIntProduct&, const UIntProduct&); // a * b + c * d: второе произведение прибавляется слитно
+UInt operator+(const UIntScaled&, const UIntScaled&);
+UInt operator%(const UIntProduct&, const UInt&);  // a * b mod m
 UInt operator^(const UInt&, const int64_t); // возведение в степень
 
+// Для временных значений результат записывается в цифры самого аргумента:
+UInt operator+(UInt&&, const UInt&);
+UInt operator+(const UInt&, UInt&&);
+UInt operator+(UInt&&, UInt&&);
+UInt operator-(UInt&&, const UInt&);
+UInt operator%(UInt&&, const UInt&);
+UInt operator+(UInt&&, const int64_t);
+UInt operator-(UInt&&, const int64_t);
+UInt operator*(UInt&&, const int64_t);
+UInt operator*(const int64_t, UInt&&);
+UInt operator/(UInt&&, const int64_t);
+
+// Операции с явным результатом: результат может совпадать с аргументами, промежуточные цифры
+// пишутся в scratch, а результат - в уже выделенную память dst (q, r), поэтому в цикле с одними и теми же
+// dst и scratch выделения памяти прекращаются после первых итераций. Длинные множители (БПФ)
+// и делители (метод Ньютона) по-прежнему обрабатываются с выделением памяти.
+void mul(UInt& dst, const UInt& a, const UInt& b, LimbVector& scratch); // dst = a * b
+void divmod(UInt& q, UInt& r, const UInt& a, const UInt& b, LimbVector& scratch); // q = a / b, r = a % b
+
+// Модуль и буферы для mulmod:
+struct MulModContext {
+    UInt mod;
+    UInt product, quotient;
+    LimbVector scratch;
+
+    explicit MulModContext(const UInt& mod) : mod(mod) {}
+};
+
+void mulmod(UInt& dst, const UInt& a, const UInt& b, MulModContext& ctx); // dst = a * b mod ctx.mod
+
 bool operator<(const UInt&, const UInt&);
 bool operator>(const UInt&, const UInt&);
 bool operator<=(const UInt&, const UInt&);
@@ -72,6 +275,198 @@ bool operator>=(const UInt&, const UInt&);
 bool operator==(const UInt&, const UInt&);
 bool operator!=(const UInt&, const UInt&);
 
+// Цифры числа value < 10^8 по байтам, старшая цифра в младшем байте:
+// сначала value делится на две половины по 4 цифры (по 32 бита), затем каждая - на пары (по 16 бит)
+// и на отдельные цифры (по 8 бит); деления на 100 и на 10 заменены умножением и сдвигом сразу для всех частей.
+static inline uint64_t swar8(uint32_t value) {
+    uint64_t v = (value / 10000) | (uint64_t)(value % 10000) << 32;
+    uint64_t q = (v * 5243 >> 19) & 0x0000007F0000007FULL;
+    v = q | (v - q * 100) << 16;
+    q = (v * 103 >> 10) & 0x000F000F000F000FULL;
+    return q | (v - q * 10) << 8;
+}
+
+void format8(char* out, uint32_t value) {
+    const uint64_t v = swar8(value) | 0x3030303030303030ULL;
+    std::memcpy(out, &v, 8);
+}
+
+char* format_u64(char* out, uint64_t value) {
+    if (value >= 100000000) {
+        out = format_u64(out, value / 100000000);
+        format8(out, (uint32_t)(value % 100000000));
+        return out + 8;
+    }
+    uint64_t v = swar8((uint32_t)value);
+    const int64_t skip = v == 0 ? 7 : __builtin_ctzll(v) / 8; // Ведущие нули
+    v = (v | 0x3030303030303030ULL) >> (8 * skip);
+    std::memcpy(out, &v, 8);
+    return out + 8 - skip;
+}
+
+uint64_t parse8(const char* s) {
+    uint64_t v;
+    std::memcpy(&v, s, 8);
+    v -= 0x3030303030303030ULL;
+    v = v * 10 + (v >> 8); // Пары цифр
+    return ((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))
+            + ((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32))) >> 32;
+}
+
+bool all_digits8(const char* s) {
+    uint64_t v;
+    std::memcpy(&v, s, 8);
+    return ((v & 0xF0F0F0F0F0F0F0F0ULL) | ((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)
+           == 0x3333333333333333ULL;
+}
+
+const char* parse_u64(const char* begin, const char* end, uint64_t& value) {
+    const char* start = begin;
+    value = 0;
+    bool overflow = false;
+    while (end - begin >= 8 && all_digits8(begin)) {
+        overflow |= __builtin_mul_overflow(value, 100000000, &value);
+        overflow |= __builtin_add_overflow(value, parse8(begin), &value);
+        begin += 8;
+    }
+    while (begin != end && *begin >= '0' && *begin <= '9') {
+        overflow |= __builtin_mul_overflow(value, 10, &value);
+        overflow |= __builtin_add_overflow(value, (uint64_t)(*begin++ - '0'), &value);
+    }
+    if (overflow) {
+        value = 0;
+        return start;
+    }
+    return begin;
+}
+
+bool is_decimal(const std::string& s) {
+    const char* begin = s.data();
+    const char* end = begin + s.size();
+    while (end - begin >= 8 && all_digits8(begin)) begin += 8;
+    while (begin != end && *begin >= '0' && *begin <= '9') ++begin;
+    return !s.empty() && begin == end;
+}
+
+void append_u64(std::string& out, uint64_t value) {
+    const size_t size = out.size();
+    out.resize(size + 28);
+    out.resize(format_u64(&out[size], value) - out.data());
+}
+
+void append_uint(std::string& out, const UInt& number) {
+    const size_t size = out.size();
+    out.resize(size + 28 + UInt::WIDTH * number.digits.size());
+    char* end = format_u64(&out[size], number.digits.back());
+    for (int64_t i = (int64_t)number.digits.size()-2; i >= 0; --i) {
+        *end++ = (char)('0' + number.digits[i] / 100000000);
+        format8(end, (uint32_t)(number.digits[i] % 100000000));
+        end += 8;
+    }
+    out.resize(end - out.data());
+}
+
+std::pmr::memory_resource*& limb_resource() {
+    thread_local std::pmr::memory_resource* resource = std::pmr::new_delete_resource();
+    return resource;
+}
+
+LimbArena::LimbArena() : pool(std::pmr::pool_options{0, LARGEST_BLOCK}), previous(limb_resource()) {
+    limb_resource() = this;
+}
+
+LimbArena::~LimbArena() {
+    assert(outstanding == 0 && "long number escaped its LimbArena scope");
+    limb_resource() = previous;
+}
+
+void* LimbArena::do_allocate(size_t bytes, size_t alignment) {
+    outstanding += bytes;
+    return pool.allocate(bytes, alignment);
+}
+
+void LimbArena::do_deallocate(void* p, size_t bytes, size_t alignment) {
+    outstanding -= bytes;
+    pool.deallocate(p, bytes, alignment);
+}
+
+// Арены потока образуют цепочку через previous, в её конце - new_delete_resource()
+bool LimbArena::is_live(const std::pmr::memory_resource* resource) {
+    for (std::pmr::memory_resource* current = limb_resource();;) {
+        if (current == resource) return true;
+        const LimbArena* arena = dynamic_cast<const LimbArena*>(current);
+        if (arena == nullptr) return resource == std::pmr::new_delete_resource();
+        current = arena->previous;
+    }
+}
+
+LimbVector::LimbVector(int64_t size, int64_t value) {
+    resize(size, value);
+}
+
+LimbVector::LimbVector(const int64_t* begin, const int64_t* end) {
+    reserve(end - begin);
+    std::copy(begin, end, ptr);
+    count = end - begin;
+}
+
+LimbVector::LimbVector(const LimbVector& other) : LimbVector(other.begin(), other.end()) {}
+
+LimbVector::LimbVector(LimbVector&& other) noexcept : resource(other.resource) {
+    *this = std::move(other);
+}
+
+LimbVector& LimbVector::operator=(const LimbVector& other) {
+    if (this != &other) {
+        count = 0;
+        reserve(other.count);
+        std::copy(other.begin(), other.end(), ptr);
+        count = other.count;
+    }
+    return *this;
+}
+
+// Динамический буфер из того же источника забирается целиком, остальное копируется:
+LimbVector& LimbVector::operator=(LimbVector&& other) noexcept {
+    if (this == &other) return *this;
+    if (other.is_inline() || other.resource != resource) {
+        count = 0;
+        reserve(other.count);
+        std::copy(other.begin(), other.end(), ptr);
+    } else {
+        release();
+        ptr = other.ptr;
+        capacity = other.capacity;
+        other.ptr = other.storage;
+        other.capacity = INLINE;
+    }
+    count = other.count;
+    other.count = 0;
+    return *this;
+}
+
+void LimbVector::resize(int64_t n, int64_t value) {
+    reserve(n);
+    if (n > count) std::fill(ptr + count, ptr + n, value);
+    count = n;
+}
+
+void LimbVector::grow(int64_t n) {
+    assert(LimbArena::is_live(resource) && "long number escaped its LimbArena scope");
+    if (n < INLINE) n = INLINE;
+    int64_t* buffer = (int64_t*)resource->allocate(n * sizeof(int64_t), alignof(int64_t));
+    std::copy(ptr, ptr + count, buffer);
+    release();
+    ptr = buffer;
+    capacity = n;
+}
+
+void LimbVector::release() {
+    if (!is_inline()) resource->deallocate(ptr, capacity * sizeof(int64_t), alignof(int64_t));
+    ptr = storage;
+    capacity = INLINE;
+}
+
 UInt& UInt::normalize() {
     while (digits.back() == 0 && (int64_t)digits.size() > 1) digits.pop_back();
     for (auto d : digits) assert(0 <= d && d < BASE);
@@ -89,18 +484,27 @@ UInt::UInt(int64_t number) {
 }
 
 // Конструктор от вектора из цифр:
-UInt::UInt(const std::vector<int64_t>& digits) : digits(digits) {
+UInt::UInt(const std::vector<int64_t>& digits) : digits(digits.data(), digits.data() + digits.size()) {
+    normalize();
+}
+
+UInt::UInt(LimbVector digits) : digits(std::move(digits)) {
     normalize();
 }
 
 // Конструктор от строчки:
 UInt::UInt(const std::string& s) {
+    if (!is_decimal(s)) throw std::invalid_argument("UInt: not a decimal number: " + s.substr(0, 40));
     const int64_t size = (int64_t)s.size();
+    digits.reserve(size / WIDTH + 1);
     for (int64_t idGroup = 1, nGroups = size / WIDTH; idGroup <= nGroups; ++idGroup) {
-        digits.push_back(std::stoi(s.substr(size-idGroup * WIDTH, WIDTH)));
+        const char* group = s.data() + size - idGroup * WIDTH;
+        digits.push_back((group[0] - '0') * 100000000 + (int64_t)parse8(group + 1));
     }
     if (size % WIDTH != 0) {
-        digits.push_back(std::stoi(s.substr(0, size % WIDTH)));
+        uint64_t value = 0;
+        parse_u64(s.data(), s.data() + size % WIDTH, value);
+        digits.push_back((int64_t)value);
     }
     normalize();
 }
@@ -215,7 +619,7 @@ UInt UInt::slow_mult(const UInt& other) const {
     }
     const int64_t s1 = (int64_t)this->digits.size();
     const int64_t s2 = (int64_t)other.digits.size();
-    std::vector<int64_t> temp(s1+s2);
+    LimbVector temp(s1+s2);
     for (int64_t i = 0; i < s1; ++i) {
         int64_t rem = 0;
         for (int64_t j = 0; j < s2; ++j) {
@@ -226,139 +630,170 @@ UInt UInt::slow_mult(const UInt& other) const {
         }
         if (rem > 0) temp[i+s2] += rem;
     }
-    return UInt(temp);
+    return UInt(std::move(temp));
 }
 
-// Быстрое умножение на основе быстрого преобразования Фурье:
+// Быстрое умножение на основе быстрого преобразования Фурье. Цифры разбиваются на коэффициенты по три
+// десятичных; множители кладутся в одно комплексное преобразование (a - в вещественную часть, b - в мнимую),
+// тогда произведение получается из квадрата образа, и вместо трёх преобразований хватает двух.
 UInt UInt::fast_mult(const UInt& other) const {
     if (other.digits.size() == 1u) {
         return *this * other.digits[0];
     }
-
-    // Разворот битов в числе num:
-    std::function<int64_t(int64_t, int64_t)> reverse = [](int64_t number, int64_t nBits) {
-        int64_t res = 0;
-        for (int64_t i = 0; i < nBits; ++i) {
-            if (number & (1 << i)) {
-                res |= 1 << (nBits-1-i);
-            }
-        }
-        return res;
+    assert(BASE == 1000 * 1000 * 1000);
+    assert((int64_t)(digits.size() + other.digits.size()) <= FFT_MAX_LENGTH);
+    typedef std::complex<double> complex;
+    // Произведение без проверок на бесконечности и NaN (std::complex вызывает для них библиотечную функцию):
+    auto times = [](const complex& x, const complex& y) {
+        return complex(x.real() * y.real() - x.imag() * y.imag(), x.real() * y.imag() + x.imag() * y.real());
     };
 
-    typedef std::complex<long double> complex;
-    // Быстрое преобразование Фурье:
-    std::function<void(std::vector<complex>&, bool)> fft = [&reverse](std::vector<complex> & a, bool invert) {
-        const int64_t n = (int64_t)a.size();
-        int64_t nBits = 0;
-        while ((1 << nBits) < n) ++nBits;
+    const int64_t size = 3 * (int64_t)(digits.size() + other.digits.size());
+    int64_t nBits = 1;
+    while ((1LL << nBits) < size) ++nBits;
+    const int64_t n = 1LL << nBits;
+
+    // Корни из единицы: roots[k + j] = exp(i * PI * j / k) для степеней двойки k. Каждый получается
+    // из корня предыдущего уровня одним умножением в long double, поэтому погрешность не накапливается.
+    std::vector<complex> roots(n, complex(1));
+    std::vector<std::complex<long double>> precise(n, 1);
+    for (int64_t k = 2; k < n; k *= 2) {
+        const auto step = std::polar(1.0L, PI / k);
+        for (int64_t i = k; i < 2 * k; ++i) {
+            precise[i] = i & 1 ? precise[i / 2] * step : precise[i / 2];
+            roots[i] = complex(precise[i]);
+        }
+    }
+    precise.clear();
+    precise.shrink_to_fit();
+    // Перестановка с разворотом битов индекса:
+    std::vector<int32_t> reverse(n);
+    for (int64_t i = 1; i < n; ++i) {
+        reverse[i] = (int32_t)((reverse[i / 2] | (i & 1) << nBits) / 2);
+    }
 
+    // Прямое преобразование (обратное - то же с перестановкой результата):
+    auto fft = [&](std::vector<complex>& a) {
         for (int64_t i = 0; i < n; ++i) {
-            if (i < reverse(i, nBits)) {
-                std::swap(a[i], a[reverse(i, nBits)]);
-            }
+            if (i < reverse[i]) std::swap(a[i], a[reverse[i]]);
         }
-
-        for (int64_t len = 2; len <= n; len <<= 1) {
-            auto ang = 2*PI / len * (invert ? -1 : 1);
-            complex wlen (std::cos(ang), std::sin(ang));
-            for (int64_t i = 0; i < n; i += len) {
-                complex w(1);
-                for (int64_t j = 0; j < len / 2; ++j) {
-                    complex u = a[i+j];
-                    complex v = a[i+j+len / 2] * w;
-                    a[i+j] = u + v;
-                    a[i+j+len/2] = u - v;
-                    w *= wlen;
+        for (int64_t k = 1; k < n; k *= 2) {
+            for (int64_t i = 0; i < n; i += 2 * k) {
+                for (int64_t j = 0; j < k; ++j) {
+                    const complex z = times(roots[j + k], a[i + j + k]);
+                    a[i + j + k] = a[i + j] - z;
+                    a[i + j] += z;
                 }
             }
         }
-        if (invert) {
-            for (int64_t i = 0; i < n; ++i) {
-                a[i] /= n;
-            }
-        }
-    };
-
-    // Подготавливаем вектора из комплексных коэффициентов fa и fb:
-    // Так как происходит потеря точности из-за арифметики с плавающей точкой, основание системы необходимо понизить:
-    assert(BASE == 1000 * 1000 * 1000);
-    std::function<std::vector<complex>(const UInt&)> prepare = [](const UInt& number) {
-        std::vector<complex> result;
-        result.reserve(3 * number.digits.size());
-        for (auto d : number.digits) {
-            result.push_back(d % 1000);
-            result.push_back(d / 1000 % 1000);
-            result.push_back(d / 1000000);
-        }
-        return result;
     };
 
-    auto fa = prepare(*this);
-    auto fb = prepare(other);
-
-    // Округляем размер векторов до ближайшей степени двойки:
-    int64_t n = 1;
-    while (n < (int64_t)std::max(fa.size(), fb.size())) n *= 2;
-    n *= 2;
-    fa.resize(n);
-    fb.resize(n);
-
-    // Вызываем прямое преобразование Фурье:
-    fft (fa, false);
-    fft (fb, false);
-    // Перемножаем результаты:
+    std::vector<complex> in(n), out(n);
+    for (int64_t i = 0; i < (int64_t)digits.size(); ++i) {
+        const int64_t d = digits[i];
+        in[3*i].real(d % 1000);
+        in[3*i + 1].real(d / 1000 % 1000);
+        in[3*i + 2].real(d / 1000000);
+    }
+    for (int64_t i = 0; i < (int64_t)other.digits.size(); ++i) {
+        const int64_t d = other.digits[i];
+        in[3*i].imag(d % 1000);
+        in[3*i + 1].imag(d / 1000 % 1000);
+        in[3*i + 2].imag(d / 1000000);
+    }
+    fft(in);
+    // (A + iB)^2 = A^2 - B^2 + 2iAB; образ A*B выделяется через сопряжённый элемент в -i:
+    for (auto& x : in) x = times(x, x);
     for (int64_t i = 0; i < n; ++i) {
-        fa[i] *= fb[i];
+        out[i] = in[-i & (n - 1)] - std::conj(in[i]);
     }
-    // Вызываем обратное преобразование Фурье:
-    fft (fa, true);
-    // Копируем ответ с округлениями:
-    std::vector<int64_t> temp(n);
-    for (int64_t i = 0; i < (int64_t)fa.size(); ++i) {
-        temp[i] = int64_t (fa[i].real() + 0.5);
+    fft(out);
+
+    // Коэффициенты с округлениями и переносами, по три в одну цифру ответа:
+    LimbVector res;
+    res.reserve(digits.size() + other.digits.size());
+    int64_t carry = 0;
+    for (int64_t i = 0; i < size; i += 3) {
+        int64_t limb = 0, scale = 1;
+        for (int64_t j = 0; j < 3; ++j, scale *= 1000) {
+            carry += (int64_t)std::llround(out[i + j].imag() / (4 * n));
+            limb += carry % 1000 * scale;
+            carry /= 1000;
+        }
+        res.push_back(limb);
     }
-    // Не забываем про переносы в старшие разряды:
+    assert(carry == 0);
+    return UInt(std::move(res));
+}
+
+// res[offset..) += number; res достаточно длинный, чтобы перенос не выходил за край:
+static void add_shifted(LimbVector& res, const UInt& number, int64_t offset) {
+    const int64_t BASE = UInt::BASE;
     int64_t carry = 0;
-    for (int64_t i = 0; i < n || carry > 0; ++i) {
-        if (i >= n) temp.push_back(0);
-        temp[i] += carry;
-        carry = temp[i] / 1000;
-        temp[i] -= carry * 1000;
-        assert(temp[i] >= 0);
+    for (int64_t i = offset, j = 0; j < (int64_t)number.digits.size() || carry > 0; ++i, ++j) {
+        carry += res[i] + (j < (int64_t)number.digits.size() ? number.digits[j] : 0);
+        res[i] = carry >= BASE ? carry - BASE : carry;
+        carry = carry >= BASE;
     }
-    // Формируем ответ:
-    std::vector<int64_t> res;
-    res.reserve(this->digits.size() + other.digits.size());
+}
 
-    for (int64_t i = 0; i < n; i += 3) {
-        int64_t c = temp[i];
-        int64_t b = i+1 < n ? temp[i+1] : 0;
-        int64_t a = i+2 < n ? temp[i+2] : 0;
-        res.push_back(c + 1000 * (b + 1000 * a));
+// Умножение Карацубы: a = a1 * BASE^h + a0, b = b1 * BASE^h + b0, и из трёх произведений половин
+// a0 * b0, a1 * b1 и (a0 + a1) * (b0 + b1) собирается всё произведение. Половины умножаются через mult,
+// так что рекурсия сама переходит к столбику или к преобразованию Фурье. Если b не длиннее половины a,
+// a режется на куски длины b, и каждый кусок умножается на b отдельно.
+UInt UInt::karatsuba_mult(const UInt& other) const {
+    const int64_t s1 = (int64_t)digits.size();
+    const int64_t s2 = (int64_t)other.digits.size();
+    if (s1 < s2) return other.karatsuba_mult(*this);
+    LimbVector res(s1 + s2 + 1);
+    if (2 * s2 <= s1) {
+        for (int64_t i = 0; i < s1; i += s2) {
+            const UInt piece(LimbVector(digits.begin() + i, digits.begin() + std::min(s1, i + s2)));
+            add_shifted(res, piece.mult(other), i);
+        }
+        return UInt(std::move(res));
     }
-    return UInt(res);
+    const int64_t h = (s1 + 1) / 2;
+    const UInt a0 = low_digits(h), a1 = shifted(-h);
+    const UInt b0 = other.low_digits(h), b1 = other.shifted(-h);
+    const UInt low = a0.mult(b0), high = a1.mult(b1);
+    UInt middle = (a0 + a1).mult(b0 + b1);
+    middle -= low;
+    middle -= high;
+    add_shifted(res, low, 0);
+    add_shifted(res, middle, h);
+    add_shifted(res, high, 2 * h);
+    return UInt(std::move(res));
 }
 
 // Комбинированный метод умножения:
 UInt UInt::mult(const UInt& other) const {
-// Выбор метода умножения:
-    int64_t len1 = (int64_t)this->digits.size();
-    int64_t len2 = (int64_t)other.digits.size();
-    int64_t temp = 3 * std::max(len1, len2);
-    int64_t pow = 1;
-    while (pow < temp) pow *= 2;
-    pow *= 2;
-    int64_t op1 = len1 * len2;
-    int64_t op2 = 3 * pow * std::log(pow) / std::log(2);
-    return op1 >= 15 * op2 ? fast_mult(other) : slow_mult(other);
+    const int64_t s1 = (int64_t)digits.size();
+    const int64_t s2 = (int64_t)other.digits.size();
+    if (fast_mult_pays(s1, s2)) return fast_mult(other);
+    if (std::min(s1, s2) >= KARATSUBA_THRESHOLD) return karatsuba_mult(other);
+    return slow_mult(other);
+}
+
+// Выбор метода умножения: преобразование Фурье окупается, когда оба множителя длинные. Слишком длинные
+// произведения (где погрешность double уже опасна) karatsuba_mult делит на части, которые проходят.
+bool UInt::fast_mult_pays(int64_t len1, int64_t len2) {
+    return std::min(len1, len2) >= FFT_THRESHOLD && len1 + len2 <= FFT_MAX_LENGTH;
 }
 
 // Деление на короткое:
 UInt& UInt::operator/=(const int64_t num) {
     assert(num > 0);
     if (num >= BASE) {
-        return *this /= UInt(num);
+        // Остаток меньше num, поэтому промежуточное значение помещается в 128 бит:
+        __int128 rem = 0;
+        for (int64_t j = (int64_t)digits.size()-1; j >= 0; --j) {
+            rem = rem * BASE + digits[j];
+            auto div = rem / num;
+            digits[j] = (int64_t)div;
+            rem -= div * num;
+        }
+        return this->normalize();
     }
     int64_t rem = 0;
     for (int64_t j = (int64_t)digits.size()-1; j >= 0; --j) {
@@ -373,6 +808,14 @@ UInt& UInt::operator/=(const int64_t num) {
 // Остаток от деления на короткое:
 int64_t operator%(const UInt& a, const int64_t num) {
     assert(num > 0);
+    // Пока rem * BASE + цифра помещается в int64_t, обходимся без 128-битного деления
+    if (num > INT64_MAX / UInt::BASE) {
+        __int128 rem = 0;
+        for (int64_t i = (int64_t)a.digits.size()-1; i >= 0; --i) {
+            rem = (rem * UInt::BASE + a.digits[i]) % num;
+        }
+        return (int64_t)rem;
+    }
     int64_t rem = 0;
     for (int64_t i = (int64_t)a.digits.size()-1; i >= 0; --i) {
         ((rem *= UInt::BASE) += a.digits[i]) %= num;
@@ -385,28 +828,93 @@ std::pair<UInt, UInt> UInt::div_mod(const UInt& other) const {
     if (other.digits.size() == 1u) {
         return {std::move(*this / other.digits[0]), *this % other.digits[0]};
     }
-    const int64_t norm = BASE / (other.digits.back() + 1);
-    const UInt a = *this * norm;
-    const UInt b = other * norm;
-    const int64_t a_size = (int64_t)a.digits.size();
-    const int64_t b_size = (int64_t)b.digits.size();
+    if ((int64_t)other.digits.size() >= NEWTON_THRESHOLD) {
+        return newton_div_mod(other);
+    }
     UInt q, r;
-    q.digits.resize(a_size);
-    for (int64_t i = a_size - 1; i >= 0; --i) {
-        r *= BASE;
-        r += a.digits[i];
-        int64_t s1 = (int64_t)r.digits.size() <= b_size ? 0 : r.digits[b_size];
-        int64_t s2 = (int64_t)r.digits.size() <= b_size - 1 ? 0 : r.digits[b_size - 1];
-        int64_t d = (1LL * BASE * s1 + s2) / b.digits.back();
-        auto temp = b * d;
-        while (r < temp) {
-            r += b;
-            --d;
-        }
-        r -= temp;
-        q.digits[i] = d;
+    LimbVector scratch;
+    divmod(q, r, *this, other, scratch);
+    return {std::move(q), std::move(r)};
+}
+
+// Сдвиг на n цифр:
+UInt UInt::shifted(int64_t n) const {
+    const int64_t size = (int64_t)digits.size();
+    if (n >= 0) {
+        if (size == 1 && digits[0] == 0) return *this;
+        LimbVector res(n + size);
+        std::copy(digits.begin(), digits.end(), res.begin() + n);
+        return UInt(std::move(res));
+    }
+    if (-n >= size) return UInt(0);
+    return UInt(LimbVector(digits.begin() - n, digits.end()));
+}
+
+// Младшие n цифр:
+UInt UInt::low_digits(int64_t n) const {
+    if (n >= (int64_t)digits.size()) return *this;
+    if (n <= 0) return UInt(0);
+    return UInt(LimbVector(digits.begin(), digits.begin() + n));
+}
+
+// Обратное число floor(BASE^(2m) / b), m - длина b:
+// обратное к старшим h цифрам вычисляется рекурсивно, затем уточняется одним шагом Ньютона
+// x = 2x - b * x^2 / BASE^(2m). Три запасные цифры в h оставляют после шага погрешность в несколько единиц,
+// которая устраняется точной поправкой.
+UInt UInt::reciprocal() const {
+    const int64_t m = (int64_t)digits.size();
+    const UInt target = UInt(1).shifted(2 * m);
+    if (m <= NEWTON_LEAF) {
+        return target.div_mod(*this).first;
+    }
+    const int64_t h = m / 2 + 3;
+    const UInt x0 = shifted(h - m).reciprocal().shifted(m - h);
+    UInt x = x0 * 2;
+    x -= (*this * x0 * x0).shifted(-2 * m);
+
+    UInt prod = *this * x;
+    while (prod > target) {
+        x -= 1;
+        prod -= *this;
+    }
+    UInt rem = target - prod;
+    while (rem >= *this) {
+        x += 1;
+        rem -= *this;
+    }
+    return x;
+}
+
+// Деление через обратное: частное q = a * floor(BASE^(k+m) / b) / BASE^(k+m) меньше точного не более чем на 2
+std::pair<UInt, UInt> UInt::newton_div_mod(const UInt& other) const {
+    if (*this < other) {
+        return {UInt(0), *this};
+    }
+    const int64_t n = (int64_t)this->digits.size();
+    const int64_t m = (int64_t)other.digits.size();
+    const int64_t k = std::max(m, n - m);
+    const UInt inv = other.shifted(k - m).reciprocal();
+    UInt q = (*this * inv).shifted(-(k + m));
+    UInt r = *this - q * other;
+    while (r >= other) {
+        q += 1;
+        r -= other;
     }
-    return {std::move(q.normalize()), std::move(r /= norm)};
+    return {std::move(q), std::move(r)};
+}
+
+// Деление с заранее вычисленным обратным (делимое не длиннее удвоенной длины делителя),
+// удобно при многократном делении на одно и то же число:
+std::pair<UInt, UInt> UInt::div_mod(const UInt& other, const UInt& inv) const {
+    const int64_t m = (int64_t)other.digits.size();
+    assert((int64_t)this->digits.size() <= 2 * m);
+    UInt q = (*this * inv).shifted(-2 * m);
+    UInt r = *this - q * other;
+    while (r >= other) {
+        q += 1;
+        r -= other;
+    }
+    return {std::move(q), std::move(r)};
 }
 
 // Сравнение: result < 0 (меньше), result == 0 (равно), result > 0 (больше)
@@ -438,11 +946,9 @@ std::istream& operator>>(std::istream& is, UInt& number) {
 
 // Вывод в поток:
 std::ostream& operator<<(std::ostream& os, const UInt& number) {
-    os << number.digits.back();
-    for (int64_t i = (int64_t)number.digits.size()-2; i >= 0; --i) {
-        os << std::setw(UInt::WIDTH) << std::setfill('0') << number.digits[i];
-    }
-    return os << std::setfill(' ');
+    std::string text;
+    append_uint(text, number);
+    return os << text;
 }
 
 // Сумма:
@@ -455,9 +961,9 @@ UInt operator-(const UInt& a, const UInt& b) {
     return UInt(a) -= b;
 }
 
-// Произведение:
-UInt operator*(const UInt& a, const UInt& b) {
-    return a.mult(b);
+// Произведение (вычисляется при использовании):
+UIntProduct operator*(const UInt& a, const UInt& b) {
+    return {a, b};
 }
 
 // Деление:
@@ -470,127 +976,2833 @@ UInt operator%(const UInt& a, const UInt& b) {
     return a.div_mod(b).second;
 }
 
+// Буфер промежуточных цифр для составных операторов (у каждого потока свой):
+static LimbVector& thread_scratch() {
+    thread_local LimbVector scratch(std::pmr::new_delete_resource());
+    return scratch;
+}
+
 // Умножение:
 UInt& UInt::operator*=(const UInt& other) {
-    return *this = *this * other;
+    mul(*this, *this, other, thread_scratch());
+    return *this;
 }
 
 // Деление с присваиванием:
 UInt& UInt::operator/=(const UInt& other) {
-    return *this = *this / other;
+    UInt r;
+    divmod(*this, r, *this, other, thread_scratch());
+    return *this;
 }
 
 // Взятие остатка с присваиванием:
 UInt& UInt::operator%=(const UInt& other) {
-    return *this = *this % other;
+    UInt q;
+    divmod(q, *this, *this, other, thread_scratch());
+    return *this;
 }
 
 UInt operator+(const UInt& a, const int64_t b) { return UInt(a) += b; }
-UInt operator+(const int64_t a, const UInt& b) { return b * a; }
+UInt operator+(const int64_t a, const UInt& b) { return b + a; }
 UInt operator-(const UInt& a, const int64_t b) { return UInt(a) -= b; }
-UInt operator*(const UInt& a, const int64_t b) { return UInt(a) *= b; }
-UInt operator*(const int64_t a, const UInt& b) { return b * a; }
+UIntScaled operator*(const UInt& a, const int64_t b) { return {a, b}; }
+UIntScaled operator*(const int64_t a, const UInt& b) { return {b, a}; }
 UInt operator/(const UInt& a, const int64_t b) { return UInt(a) /= b; }
 
-// Наибольший общий делитель:
-UInt gcd(UInt a, UInt b) {
-    while (b != 0) {
-        auto rem = a % b;
-        a = b;
-        b = rem;
+UInt operator+(UInt&& a, const UInt& b) { return std::move(a += b); }
+UInt operator+(const UInt& a, UInt&& b) { return std::move(b += a); }
+UInt operator+(UInt&& a, UInt&& b) { return std::move(a += b); }
+UInt operator-(UInt&& a, const UInt& b) { return std::move(a -= b); }
+UInt operator%(UInt&& a, const UInt& b) { return std::move(a %= b); }
+UInt operator+(UInt&& a, const int64_t b) { return std::move(a += b); }
+UInt operator-(UInt&& a, const int64_t b) { return std::move(a -= b); }
+UInt operator*(UInt&& a, const int64_t b) { return std::move(a *= b); }
+UInt operator*(const int64_t a, UInt&& b) { return std::move(b *= a); }
+UInt operator/(UInt&& a, const int64_t b) { return std::move(a /= b); }
+
+// Произведение столбиком в scratch, затем буферы dst и scratch меняются местами:
+void mul(UInt& dst, const UInt& a, const UInt& b, LimbVector& scratch) {
+    const int64_t BASE = UInt::BASE;
+    const int64_t s1 = (int64_t)a.digits.size();
+    const int64_t s2 = (int64_t)b.digits.size();
+    if (std::min(s1, s2) >= UInt::KARATSUBA_THRESHOLD) {
+        dst = a.mult(b);
+        return;
     }
-    return a;
+    scratch.clear();
+    scratch.resize(s1 + s2);
+    for (int64_t i = 0; i < s1; ++i) {
+        int64_t rem = 0;
+        for (int64_t j = 0; j < s2; ++j) {
+            rem += scratch[i+j] + a.digits[i] * b.digits[j];
+            const int64_t div = rem / BASE;
+            scratch[i+j] = rem - div * BASE;
+            rem = div;
+        }
+        scratch[i+s2] = rem;
+    }
+    while (scratch.size() > 1 && scratch.back() == 0) scratch.pop_back();
+    std::swap(dst.digits, scratch);
 }
 
-#include <random>
-#include <vector>
-#include <cmath>
+// Деление столбиком (алгоритм D Кнута). В scratch лежат нормализованные делимое u и делитель v
+// (старшая цифра v не меньше BASE / 2) и цифры частного. Очередная цифра частного оценивается
+// по двум старшим цифрам остатка и уточняется по третьей, после чего ошибается не больше чем на единицу.
+void divmod(UInt& q, UInt& r, const UInt& a, const UInt& b, LimbVector& scratch) {
+    const int64_t BASE = UInt::BASE;
+    assert(&q != &r && b != 0);
+    const int64_t n = (int64_t)b.digits.size();
+    const int64_t m = (int64_t)a.digits.size() - n;
+    if (m < 0) {
+        r = a;
+        q = 0;
+        return;
+    }
+    if (n >= UInt::NEWTON_THRESHOLD) {
+        auto qr = a.newton_div_mod(b);
+        q = std::move(qr.first);
+        r = std::move(qr.second);
+        return;
+    }
+    const int64_t norm = BASE / (b.digits.back() + 1);
+    scratch.clear();
+    scratch.resize((m + n + 1) + n + (m + 1));
+    int64_t* u = scratch.data();
+    int64_t* v = u + (m + n + 1);
+    int64_t* quotient = v + n;
+    int64_t carry = 0;
+    for (int64_t i = 0; i < m + n; ++i) {
+        carry += a.digits[i] * norm;
+        u[i] = carry % BASE;
+        carry /= BASE;
+    }
+    u[m + n] = carry;
+    carry = 0;
+    for (int64_t i = 0; i < n; ++i) {
+        carry += b.digits[i] * norm;
+        v[i] = carry % BASE;
+        carry /= BASE;
+    }
+    for (int64_t j = m; j >= 0; --j) {
+        const int64_t top = u[j+n] * BASE + u[j+n-1];
+        int64_t d = top / v[n-1];
+        int64_t rest = top % v[n-1];
+        while (n > 1 && (d >= BASE || d * v[n-2] > rest * BASE + u[j+n-2])) {
+            --d;
+            rest += v[n-1];
+            if (rest >= BASE) break;
+        }
+        // u[j..j+n] -= d * v:
+        int64_t borrow = 0;
+        carry = 0;
+        for (int64_t i = 0; i < n; ++i) {
+            const int64_t product = d * v[i] + carry;
+            carry = product / BASE;
+            const int64_t cur = u[i+j] - (product - carry * BASE) - borrow;
+            borrow = cur < 0 ? 1 : 0;
+            u[i+j] = cur + borrow * BASE;
+        }
+        const int64_t cur = u[j+n] - carry - borrow;
+        if (cur < 0) {
+            // Оценка оказалась на единицу больше: возвращаем v обратно
+            --d;
+            carry = 0;
+            for (int64_t i = 0; i < n; ++i) {
+                const int64_t sum = u[i+j] + v[i] + carry;
+                carry = sum >= BASE ? 1 : 0;
+                u[i+j] = sum - carry * BASE;
+            }
+        }
+        u[j+n] = 0;
+        quotient[j] = d;
+    }
+    // Остаток - младшие n цифр u, делённые на norm:
+    int64_t rem = 0;
+    for (int64_t i = n - 1; i >= 0; --i) {
+        const int64_t cur = rem * BASE + u[i];
+        u[i] = cur / norm;
+        rem = cur % norm;
+    }
+    q.digits.clear();
+    q.digits.resize(m + 1);
+    std::copy(quotient, quotient + m + 1, q.digits.begin());
+    q.normalize();
+    r.digits.clear();
+    r.digits.resize(n);
+    std::copy(u, u + n, r.digits.begin());
+    r.normalize();
+}
 
-using namespace std;
+void mulmod(UInt& dst, const UInt& a, const UInt& b, MulModContext& ctx) {
+    mul(ctx.product, a, b, ctx.scratch);
+    divmod(ctx.quotient, dst, ctx.product, ctx.mod, ctx.scratch);
+}
+
+// acc[0..n) += a[0..n) * k при k < BASE, возвращает перенос из старшей цифры (меньше BASE):
+static int64_t addmul_1(int64_t* acc, const int64_t* a, int64_t n, int64_t k) {
+    const int64_t BASE = UInt::BASE;
+    int64_t carry = 0;
+    for (int64_t i = 0; i < n; ++i) {
+        const int64_t cur = acc[i] + a[i] * k + carry;
+        carry = cur / BASE;
+        acc[i] = cur - carry * BASE;
+    }
+    return carry;
+}
+
+// acc += a * b: для каждой цифры b одно addmul_1 прямо в цифрах acc (acc не совпадает с множителями).
+static void addmul(UInt& acc, const UInt& a, const UInt& b) {
+    const int64_t s1 = (int64_t)a.digits.size();
+    const int64_t s2 = (int64_t)b.digits.size();
+    if (&acc == &a || &acc == &b || std::min(s1, s2) >= UInt::KARATSUBA_THRESHOLD) {
+        acc += a.mult(b);
+        return;
+    }
+    const int64_t size = std::max((int64_t)acc.digits.size(), s1 + s2) + 1;
+    acc.digits.resize(size);
+    for (int64_t j = 0; j < s2; ++j) {
+        int64_t carry = addmul_1(acc.digits.data() + j, a.digits.data(), s1, b.digits[j]);
+        for (int64_t i = j + s1; carry > 0; ++i) {
+            carry += acc.digits[i];
+            acc.digits[i] = carry % UInt::BASE;
+            carry /= UInt::BASE;
+        }
+    }
+    acc.normalize();
+}
+
+UIntScaled::operator UInt() const {
+    return UInt(a) *= k;
+}
 
-int64_t prime = 0, g = 0, key = 0;
+UInt& UInt::operator+=(const UIntProduct& product) {
+    addmul(*this, product.a, product.b);
+    return *this;
+}
 
+UInt& UInt::operator+=(const UIntScaled& product) {
+    if (product.k >= BASE) {
+        addmul(*this, product.a, UInt(product.k));
+        return *this;
+    }
+    assert(product.k >= 0);
+    const int64_t n = (int64_t)product.a.digits.size();
+    digits.resize(std::max((int64_t)digits.size(), n) + 1);
+    int64_t carry = addmul_1(digits.data(), product.a.digits.data(), n, product.k);
+    for (int64_t i = n; carry > 0; ++i) {
+        carry += digits[i];
+        digits[i] = carry % BASE;
+        carry /= BASE;
+    }
+    return normalize();
+}
 
-// Возведение в степень:
-UInt pow(UInt a, long long n, long long mod) {
-    if (mod == -1) {
-        UInt res = 1;
-        while (n > 0) {
-            if (n % 2 != 0) res *= a;
-            a *= a;
-            n /= 2;
+UInt operator+(const UInt& c, const UIntProduct& p) { return UInt(c) += p; }
+UInt operator+(const UIntProduct& p, const UInt& c) { return UInt(c) += p; }
+UInt operator+(UInt&& c, const UIntProduct& p) { return std::move(c += p); }
+UInt operator+(const UInt& c, const UIntScaled& p) { return UInt(c) += p; }
+UInt operator+(const UIntScaled& p, const UInt& c) { return UInt(c) += p; }
+UInt operator+(UInt&& c, const UIntScaled& p) { return std::move(c += p); }
+UInt operator+(const UIntProduct& p, const UIntProduct& r) { return UInt(p) += r; }
+UInt operator+(const UIntScaled& p, const UIntScaled& r) { return UInt(p) += r; }
+
+// a * b mod m: произведение пишется в буфер потока, который переиспользуется от вызова к вызову.
+// Длинные модули (деление методом Ньютона) обрабатываются обычным путём.
+UInt operator%(const UIntProduct& p, const UInt& m) {
+    if ((int64_t)m.digits.size() >= UInt::NEWTON_THRESHOLD) return p.a.mult(p.b) % m;
+    // Буферы живут до конца потока, поэтому их цифры всегда берутся из new_delete_resource(), даже если
+    // первый вызов случился внутри LimbArena (перемещающее присваивание источник не меняет).
+    struct Buffers {
+        UInt product, quotient;
+        LimbVector scratch;
+        static UInt unpooled() {
+            LimbVector digits(std::pmr::new_delete_resource());
+            digits.push_back(0);
+            return UInt(std::move(digits));
         }
-        return res;
+        Buffers() : product(unpooled()), quotient(unpooled()), scratch(std::pmr::new_delete_resource()) {}
+    };
+    thread_local Buffers buffers;
+    UInt res;
+    mul(buffers.product, p.a, p.b, buffers.scratch);
+    divmod(buffers.quotient, res, buffers.product, m, buffers.scratch);
+    return res;
+}
+
+// Бинарный алгоритм: общие множители 2 выносятся сразу, затем из большего числа вычитается меньшее
+// и у разности отбрасываются младшие нулевые биты. Делений нет совсем.
+uint64_t binary_gcd(uint64_t a, uint64_t b) {
+    if (a == 0) return b;
+    if (b == 0) return a;
+    const int shift = __builtin_ctzll(a | b);
+    a >>= __builtin_ctzll(a);
+    do {
+        b >>= __builtin_ctzll(b);
+        if (a > b) std::swap(a, b);
+        b -= a;
+    } while (b != 0);
+    return a << shift;
+}
+
+// dst = x * a - y * b при x, y < BASE и неотрицательном результате, за один проход по цифрам:
+static void lincomb(LimbVector& dst, int64_t x, const UInt& a, int64_t y, const UInt& b) {
+    const int64_t BASE = UInt::BASE;
+    const int64_t size = std::max(a.digits.size(), b.digits.size());
+    dst.clear();
+    dst.resize(size + 1);
+    int64_t carry = 0;
+    for (int64_t i = 0; i < size; ++i) {
+        int64_t cur = carry;
+        if (i < a.digits.size()) cur += x * a.digits[i];
+        if (i < b.digits.size()) cur -= y * b.digits[i];
+        carry = cur >= 0 ? cur / BASE : -((BASE - 1 - cur) / BASE);
+        dst[i] = cur - carry * BASE;
+    }
+    assert(carry >= 0);
+    dst[size] = carry;
+    while (dst.size() > 1 && dst.back() == 0) dst.pop_back();
+}
+
+// Шаг Лемера: по двум старшим цифрам a и цифрам b в тех же разрядах (числам меньше BASE^2)
+// выполняется несколько шагов Евклида с матрицей (A B; C D), пока частные для приближений снизу и сверху
+// совпадают (условие Коллинза), а коэффициенты матрицы меньше BASE. Затем матрица применяется к полным
+// числам двумя проходами lincomb, что заменяет несколько делений длинных чисел. Частные дописываются
+// в quotients (если он задан). Возвращает false, если не удалось сделать ни одного шага (a >= b, в b больше двух цифр).
+static bool lehmer_step(UInt& a, UInt& b, int64_t (&matrix)[4], std::vector<int64_t>* quotients,
+                        LimbVector& first, LimbVector& second) {
+    const int64_t BASE = UInt::BASE;
+    const int64_t n = a.digits.size();
+    int64_t ahat = a.digits[n-1] * BASE + a.digits[n-2];
+    int64_t bhat = (b.digits.size() >= n ? b.digits[n-1] * BASE : 0) + (b.digits.size() >= n - 1 ? b.digits[n-2] : 0);
+    int64_t A = 1, B = 0, C = 0, D = 1;
+    while (bhat + C != 0 && bhat + D != 0) {
+        const int64_t quotient = (ahat + A) / (bhat + C);
+        if (quotient != (ahat + B) / (bhat + D) || quotient >= BASE) break;
+        const int64_t nextC = A - quotient * C, nextD = B - quotient * D;
+        if (std::abs(nextC) >= BASE || std::abs(nextD) >= BASE) break;
+        std::tie(A, B, C, D) = std::make_tuple(C, D, nextC, nextD);
+        std::tie(ahat, bhat) = std::make_pair(bhat, ahat - quotient * bhat);
+        if (quotients != nullptr) quotients->push_back(quotient);
+    }
+    if (B == 0) return false;
+    // В каждой строке матрицы ровно один отрицательный коэффициент:
+    if (A >= 0) {
+        lincomb(first, A, a, -B, b);
+        lincomb(second, D, b, -C, a);
     } else {
-        UInt res = 1;
-        while (n > 0) {
-            if (n % 2 != 0) res *= a;
-            a *= a;
-            a %= mod;
-            n /= 2;
+        lincomb(first, B, b, -A, a);
+        lincomb(second, C, a, -D, b);
+    }
+    std::swap(a.digits, first);
+    std::swap(b.digits, second);
+    matrix[0] = A;
+    matrix[1] = B;
+    matrix[2] = C;
+    matrix[3] = D;
+    return true;
+}
+
+// Бинарное возведение в степень:
+UInt pow(UInt a, int64_t n) {
+    UInt res(1);
+    for (; n > 0; n >>= 1) {
+        if (n & 1) res *= a;
+        if (n > 1) a *= a;
+    }
+    return res;
+}
+
+// Пока в b больше двух цифр, выполняются шаги Лемера (или обычное деление с остатком, если шаг не удался),
+// затем числа меньше BASE^2 доводятся бинарным алгоритмом.
+UInt gcd(const UInt& x, const UInt& y) {
+    const int64_t BASE = UInt::BASE;
+    UInt a = x >= y ? x : y;
+    UInt b = x >= y ? y : x;
+    LimbVector first, second;
+    UInt q, r;
+    int64_t matrix[4];
+    while (b.digits.size() > 2) {
+        if (!lehmer_step(a, b, matrix, nullptr, first, second)) {
+            divmod(q, r, a, b, first);
+            std::swap(a, b);
+            std::swap(b, r);
         }
-        return res;
     }
+    if (b == 0) return a;
+    const uint64_t small = (uint64_t)(b.digits.size() == 2 ? b.digits[1] * BASE + b.digits[0] : b.digits[0]);
+    return UInt((int64_t)binary_gcd(small, (uint64_t)(a % (int64_t)small)));
 }
 
-int main() {
-    ios_base::sync_with_stdio(false);
-    cin.tie(nullptr);
-    string input_msg, empty;
-    vector<int64_t> start_vector;
-    UInt current_place(1);
-    UInt code_number(0);
+// Матрица частных алгоритма Евклида: (a, b) = M (a', b'), где (a', b') - пара после шагов с частными q1..qk,
+// M = Q(q1) ... Q(qk), Q(q) = (q 1; 1 0). Элементы неотрицательны, определитель равен (-1)^k.
+struct EuclidMatrix {
+    UInt m00 = 1, m01 = 0, m10 = 0, m11 = 1;
+    std::vector<UInt> quotients; // q1..qk, нужны для отката последних шагов
+
+    bool odd() const { return quotients.size() % 2 != 0; } // Определитель равен -1
+    void push(const UInt& q);                // M = M Q(q)
+    void pop();                              // M = M Q(qk)^(-1)
+    void append(const EuclidMatrix& other);  // M = M * other
+    void append_lehmer(const int64_t (&matrix)[4], const std::vector<int64_t>& steps); // M = M * (матрица шага Лемера)
+};
+
+void EuclidMatrix::push(const UInt& q) {
+    UInt n00 = m01 + m00 * q;
+    UInt n10 = m11 + m10 * q;
+    m01 = std::move(m00);
+    m11 = std::move(m10);
+    m00 = std::move(n00);
+    m10 = std::move(n10);
+    quotients.push_back(q);
+}
+
+void EuclidMatrix::pop() {
+    const UInt q = std::move(quotients.back());
+    quotients.pop_back();
+    UInt n01 = m00 - m01 * q;
+    UInt n11 = m10 - m11 * q;
+    m00 = std::move(m01);
+    m10 = std::move(m11);
+    m01 = std::move(n01);
+    m11 = std::move(n11);
+}
+
+void EuclidMatrix::append(const EuclidMatrix& other) {
+    UInt n00 = m00 * other.m00 + m01 * other.m10;
+    UInt n01 = m00 * other.m01 + m01 * other.m11;
+    UInt n10 = m10 * other.m00 + m11 * other.m10;
+    UInt n11 = m10 * other.m01 + m11 * other.m11;
+    m00 = std::move(n00);
+    m01 = std::move(n01);
+    m10 = std::move(n10);
+    m11 = std::move(n11);
+    quotients.insert(quotients.end(), other.quotients.begin(), other.quotients.end());
+}
+
+// Шаг Лемера переводит (a, b) в (A a + B b, C a + D b), то есть его матрица частных - (|D| |B|; |C| |A|):
+void EuclidMatrix::append_lehmer(const int64_t (&matrix)[4], const std::vector<int64_t>& steps) {
+    const int64_t A = std::abs(matrix[0]), B = std::abs(matrix[1]), C = std::abs(matrix[2]), D = std::abs(matrix[3]);
+    UInt n00 = m00 * D + m01 * C;
+    UInt n01 = m00 * B + m01 * A;
+    UInt n10 = m10 * D + m11 * C;
+    UInt n11 = m10 * B + m11 * A;
+    m00 = std::move(n00);
+    m01 = std::move(n01);
+    m10 = std::move(n10);
+    m11 = std::move(n11);
+    for (auto q : steps) quotients.push_back(UInt(q));
+}
+
+static const int64_t HGCD_THRESHOLD = 96; // Начиная с этой длины шаги Евклида выполняются половинным НОД
+
+// Один шаг Лемера (или деления с остатком) над (a, b) с записью частных в M:
+static void euclid_step(UInt& a, UInt& b, EuclidMatrix& M, LimbVector& first, LimbVector& second) {
+    int64_t matrix[4];
+    std::vector<int64_t> steps;
+    if (b.digits.size() > 2 && lehmer_step(a, b, matrix, &steps, first, second)) {
+        M.append_lehmer(matrix, steps);
+        return;
+    }
+    UInt q, r;
+    divmod(q, r, a, b, first);
+    std::swap(a, b);
+    std::swap(b, r);
+    M.push(q);
+}
+
+// (a, b) = M^(-1) (a, b), то есть a' = ±(m11 a - m01 b), b' = ±(m00 b - m10 a). Частные M найдены по старшим
+// цифрам, и последние из них могут не подходить к полным числам: тогда пара получается не убывающей или
+// отрицательной, и последние частные по одному отбрасываются. Первые частные, при которых (a', b') убывает,
+// совпадают с частными алгоритма Евклида для (a, b).
+static void apply_inverse(UInt& a, UInt& b, EuclidMatrix& M) {
+    while (!M.quotients.empty()) {
+        UInt x1 = M.m11 * a, y1 = M.m01 * b;
+        UInt x2 = M.m00 * b, y2 = M.m10 * a;
+        if (M.odd()) {
+            std::swap(x1, y1);
+            std::swap(x2, y2);
+        }
+        if (x1 >= y1 && x2 >= y2) {
+            x1 -= y1;
+            x2 -= y2;
+            if (x1 > x2) {
+                a = std::move(x1);
+                b = std::move(x2);
+                return;
+            }
+        }
+        M.pop();
+    }
+}
 
-    cin >> prime >> g >> key;
+// Половинный НОД (схема Шёнхаге): при a >= b длины n выполняет шаги Евклида, пока в b больше s = n/2 + 1 цифр.
+// Сначала рекурсивно сокращается старшая половина цифр (её частные совпадают с частными полных чисел,
+// кроме, возможно, нескольких последних, которые отбрасывает apply_inverse), затем так же старшая часть
+// того, что осталось. Время определяется скоростью умножения, а не квадратом длины.
+static void hgcd(UInt& a, UInt& b, EuclidMatrix& M, LimbVector& first, LimbVector& second) {
+    const int64_t n = a.digits.size();
+    const int64_t s = n / 2 + 1;
+    if (n < HGCD_THRESHOLD) {
+        while (b.digits.size() > s) euclid_step(a, b, M, first, second);
+        return;
+    }
+    if (b.digits.size() > s) {
+        UInt a0 = a.shifted(-(n / 2)), b0 = b.shifted(-(n / 2));
+        EuclidMatrix top;
+        hgcd(a0, b0, top, first, second);
+        apply_inverse(a, b, top);
+        M.append(top);
+    }
+    while (b.digits.size() > s) {
+        const int64_t size = a.digits.size();
+        const int64_t p = 2 * s - size;
+        if (size - s >= HGCD_THRESHOLD / 2 && p > 0) {
+            UInt a0 = a.shifted(-p), b0 = b.shifted(-p);
+            EuclidMatrix top;
+            hgcd(a0, b0, top, first, second);
+            apply_inverse(a, b, top);
+            M.append(top);
+            if (!top.quotients.empty()) continue;
+        }
+        euclid_step(a, b, M, first, second);
+    }
+}
 
-    getline(cin, empty); // Для переноса каретки
-    getline(cin, input_msg);
-    int64_t c = 0;
+UInt xgcd(const UInt& x, const UInt& y, UInt& s, UInt& t) {
+    assert(x != 0);
+    UInt a = x, b = y;
+    EuclidMatrix M;
+    if (x < y) {
+        std::swap(a, b);
+        M.push(UInt(0));
+    }
+    LimbVector first, second;
+    while (b != 0) {
+        if ((int64_t)a.digits.size() >= HGCD_THRESHOLD) {
+            const int64_t before = M.quotients.size();
+            hgcd(a, b, M, first, second);
+            if ((int64_t)M.quotients.size() > before) continue;
+        }
+        euclid_step(a, b, M, first, second);
+    }
+    // (x, y) = M (g, 0), поэтому g = ±(m11 x - m01 y):
+    if (!M.odd()) {
+        s = M.m11;
+        t = M.m01;
+    } else {
+        s = y / a - M.m11;
+        t = x / a - M.m01;
+    }
+    return a;
+}
 
-    for (auto symbol : input_msg) {
-        if (symbol >= 48 && symbol <= 57)
-            c = symbol - 48;
-        else if (symbol >= 65 && symbol <= 90)
-            c = symbol - 55;
-        else if (symbol >= 97 && symbol <= 122)
-            c = symbol - 61;
-        else if (symbol == 32)
-            c = 62;
-        else if (symbol == 46)
-            c = 63;
-        else
-            c = 64;
+UInt invmod(const UInt& a, const UInt& m) {
+    const UInt residue = a % m;
+    if (residue == 0) return UInt(0);
+    UInt s, t;
+    if (xgcd(residue, m, s, t) != 1) return UInt(0);
+    return s % m;
+}
 
-        start_vector.push_back(c);
+// Перевод между системами счисления делением пополам: на каждом уровне число делится на radix^(LEAF * 2^k)
+// (или собирается из двух половин умножением на эту степень), поэтому время определяется скоростью
+// умножения и деления длинных чисел, а не квадратом длины.
+static const int64_t RADIX_LEAF = 32; // Количество цифр, которые переводятся напрямую
+
+// Число по цифрам d[0] + d[1] * radix + d[2] * radix^2 + ... (цифры могут быть не меньше radix).
+// Цифры берутся по одной через digit(i), поэтому их не нужно предварительно складывать в вектор.
+template <typename Digit>
+UInt from_digits(int64_t size, int64_t radix, const Digit& digit) {
+    UInt result;
+    LimbArena arena;
+    std::vector<UInt> level;
+    level.reserve((size + RADIX_LEAF - 1) / RADIX_LEAF);
+    for (int64_t i = 0; i < size; i += RADIX_LEAF) {
+        UInt value(0);
+        for (int64_t j = std::min(size, i + RADIX_LEAF) - 1; j >= i; --j) {
+            value *= radix;
+            value += digit(j);
+        }
+        level.push_back(std::move(value));
+    }
+    if (level.empty()) return result;
+
+    UInt place(1);
+    for (int64_t i = 0; i < RADIX_LEAF; ++i) place *= radix;
+    while (level.size() > 1u) {
+        std::vector<UInt> next;
+        next.reserve((level.size() + 1) / 2);
+        for (size_t i = 0; i + 1 < level.size(); i += 2) {
+            next.push_back(level[i] + level[i+1] * place);
+        }
+        if (level.size() % 2 != 0) next.push_back(std::move(level.back()));
+        level.swap(next);
+        if (level.size() > 1u) place *= place;
     }
+    result = level[0];
+    return result;
+}
+
+UInt from_digits(const std::vector<int64_t>& digits, int64_t radix) {
+    return from_digits((int64_t)digits.size(), radix, [&digits](int64_t i) { return digits[i]; });
+}
 
-    for (auto v : start_vector) {
-        code_number += v * current_place;
-        current_place *= 64;
+// Рекурсивная часть to_digits: записывает ровно RADIX_LEAF * 2^level цифр числа number.
+// Для длинных степеней обратные (inverses) вычисляются один раз на уровень.
+static void to_digits_rec(const UInt& number, int64_t radix, const std::vector<UInt>& powers,
+                          const std::vector<UInt>& inverses, int64_t level, int64_t* out) {
+    if (level == 0) {
+        UInt rest = number;
+        for (int64_t i = 0; i < RADIX_LEAF; ++i) {
+            out[i] = rest % radix;
+            rest /= radix;
+        }
+        return;
     }
+    const auto& power = powers[level-1];
+    auto qr = (int64_t)power.digits.size() >= UInt::NEWTON_THRESHOLD ? number.div_mod(power, inverses[level-1])
+                                                                      : number.div_mod(power);
+    to_digits_rec(qr.second, radix, powers, inverses, level-1, out);
+    to_digits_rec(qr.first, radix, powers, inverses, level-1, out + (RADIX_LEAF << (level-1)));
+}
 
+// Цифры числа по основанию radix, младшие первыми. Если count > 0, возвращается ровно count младших цифр,
+// иначе - все значащие цифры (хотя бы одна).
+std::vector<int64_t> to_digits(const UInt& number, int64_t radix, int64_t count) {
+    assert(radix >= 2);
+    LimbArena arena;
+    std::vector<UInt> powers(1, UInt(1));
+    for (int64_t i = 0; i < RADIX_LEAF; ++i) powers[0] *= radix;
+    while (powers.back() <= number) {
+        powers.push_back(powers.back() * powers.back());
+    }
+    const int64_t level = (int64_t)powers.size() - 1;
+    std::vector<UInt> inverses(level);
+    for (int64_t i = 0; i < level; ++i) {
+        if ((int64_t)powers[i].digits.size() >= UInt::NEWTON_THRESHOLD) inverses[i] = powers[i].reciprocal();
+    }
+    std::vector<int64_t> res(RADIX_LEAF << level);
+    to_digits_rec(number, radix, powers, inverses, level, res.data());
+    if (count > 0) {
+        res.resize(count);
+    } else {
+        while (res.size() > 1u && res.back() == 0) res.pop_back();
+    }
+    return res;
+}
 
-    vector<int64_t> ready_code;
+// Генератор случайных чисел на основе ChaCha20 (ключевой поток вычисляется блоками по счётчику):
+struct ChaCha20Rng {
+    static const int64_t BLOCKS = 16; // Количество 64-байтовых блоков, вычисляемых за одно пополнение буфера
 
-    do {
-        ready_code.push_back(code_number % prime);
-        code_number /= prime;
-    } while (code_number > 0);
-    
-    string ans;
-    UInt temp(g);
-    UInt k(key);
-    for (auto digit : ready_code) {
-        int64_t b = 2 + rand() % (prime - 3);
-        ans += to_string(pow(temp, b, prime) % prime) + ' ';
-        UInt temp2(pow(k, b, prime));
-        temp2 *= digit;
-        ans += to_string(temp2 % prime) + "\n";
-        if (ans.size() >= 100000) {
-            cout << ans;
-            ans.clear();
-        }
-    }
-    cout << ans;
+    // Конструкторы
+    ChaCha20Rng(); // Общий для процесса ключ и уникальный номер потока
+    ChaCha20Rng(const std::array<uint32_t, 8>& key, uint64_t stream);
+
+    // Методы генерации:
+    uint32_t next_u32();
+    uint64_t next_u64();
+    int64_t uniform(int64_t bound); // Равномерно распределённое число из [0, bound) без смещения
+    UInt uniform(const UInt& bound); // То же для длинной границы
+
+private:
+    void refill(); // Пополнение буфера ключевого потока
+
+    std::array<uint32_t, 8> key;
+    uint64_t stream;  // Номер потока (nonce), у каждого потока выполнения свой
+    uint64_t counter; // Номер следующего блока
+    std::array<uint32_t, 16 * BLOCKS> buffer;
+    int64_t pos;
+};
+
+ChaCha20Rng& thread_rng(); // Генератор текущего потока выполнения
+
+// Шифрование потоком ChaCha20: out = in xor ключевой поток, начиная с блока counter (in и out могут
+// совпадать). Длинные данные обрабатываются параллельно.
+void chacha20_xor(const std::array<uint32_t, 8>& key, uint64_t stream, uint64_t counter,
+                  const char* in, char* out, int64_t size);
+
+// CHACHA_LANES блоков подряд (счётчики counter, counter + 1, ...) за один проход: каждое слово
+// состояния - вектор из CHACHA_LANES значений (векторные расширения GCC: один регистр SSE2 или NEON),
+// так что раунды выполняются для всех блоков сразу. Блок i записывается в out[16 * i .. 16 * i + 15].
+static const int64_t CHACHA_LANES = 4;
+typedef uint32_t ChaChaLanes __attribute__((vector_size(4 * CHACHA_LANES)));
+
+static void chacha20_lanes(const std::array<uint32_t, 8>& key, uint64_t counter, uint64_t stream, uint32_t* out) {
+    const uint32_t constants[4] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+    ChaChaLanes x[16];
+    for (int64_t i = 0; i < 4; ++i) x[i] = ChaChaLanes{} + constants[i];
+    for (int64_t i = 0; i < 8; ++i) x[4+i] = ChaChaLanes{} + key[i];
+    for (int64_t lane = 0; lane < CHACHA_LANES; ++lane) {
+        x[12][lane] = (uint32_t)(counter + lane);
+        x[13][lane] = (uint32_t)((counter + lane) >> 32);
+    }
+    x[14] = ChaChaLanes{} + (uint32_t)stream;
+    x[15] = ChaChaLanes{} + (uint32_t)(stream >> 32);
+    ChaChaLanes s[16];
+    std::copy(x, x + 16, s);
+
+    auto quarter = [&x](int a, int b, int c, int d) {
+        x[a] += x[b]; x[d] ^= x[a]; x[d] = (x[d] << 16) | (x[d] >> 16);
+        x[c] += x[d]; x[b] ^= x[c]; x[b] = (x[b] << 12) | (x[b] >> 20);
+        x[a] += x[b]; x[d] ^= x[a]; x[d] = (x[d] << 8) | (x[d] >> 24);
+        x[c] += x[d]; x[b] ^= x[c]; x[b] = (x[b] << 7) | (x[b] >> 25);
+    };
+    for (int64_t round = 0; round < 10; ++round) {
+        quarter(0, 4, 8, 12); quarter(1, 5, 9, 13); quarter(2, 6, 10, 14); quarter(3, 7, 11, 15);
+        quarter(0, 5, 10, 15); quarter(1, 6, 11, 12); quarter(2, 7, 8, 13); quarter(3, 4, 9, 14);
+    }
+    for (int64_t i = 0; i < 16; ++i) {
+        x[i] += s[i];
+        for (int64_t lane = 0; lane < CHACHA_LANES; ++lane) out[16 * lane + i] = x[i][lane];
+    }
+}
+
+// Ключ, общий для всех генераторов процесса (берётся из системного источника энтропии один раз):
+static const std::array<uint32_t, 8>& chacha20_process_key() {
+    static const std::array<uint32_t, 8> key = [] {
+        std::random_device rd;
+        std::array<uint32_t, 8> k;
+        for (auto& w : k) w = rd();
+        return k;
+    }();
+    return key;
+}
+
+static std::atomic<uint64_t> chacha20_next_stream(0);
+
+ChaCha20Rng::ChaCha20Rng() : ChaCha20Rng(chacha20_process_key(), chacha20_next_stream++) {}
+
+ChaCha20Rng::ChaCha20Rng(const std::array<uint32_t, 8>& key, uint64_t stream)
+    : key(key), stream(stream), counter(0), pos(16 * BLOCKS) {}
+
+void ChaCha20Rng::refill() {
+    static_assert(BLOCKS % CHACHA_LANES == 0, "buffer must hold whole groups of lanes");
+    for (int64_t i = 0; i < BLOCKS; i += CHACHA_LANES, counter += CHACHA_LANES) {
+        chacha20_lanes(key, counter, stream, buffer.data() + 16 * i);
+    }
+    pos = 0;
+}
+
+uint32_t ChaCha20Rng::next_u32() {
+    if (pos == 16 * BLOCKS) refill();
+    return buffer[pos++];
+}
+
+uint64_t ChaCha20Rng::next_u64() {
+    uint64_t low = next_u32();
+    return low | (uint64_t)next_u32() << 32;
+}
+
+// Равномерное число из [0, bound) (метод Лемира: умножение вместо деления, отбрасывается только "хвост"):
+int64_t ChaCha20Rng::uniform(int64_t bound) {
+    assert(bound > 0);
+    const uint64_t range = bound;
+    unsigned __int128 m = (unsigned __int128)next_u64() * range;
+    if ((uint64_t)m < range) {
+        const uint64_t threshold = -range % range;
+        while ((uint64_t)m < threshold) {
+            m = (unsigned __int128)next_u64() * range;
+        }
+    }
+    return (int64_t)(m >> 64);
+}
+
+// Равномерное длинное число из [0, bound):
+// младшие цифры выбираются из [0, BASE), старшая - из [0, bound.digits.back()], лишнее отбрасывается
+// (вероятность принять число не меньше 1/2)
+UInt ChaCha20Rng::uniform(const UInt& bound) {
+    assert(bound > 0);
+    const int64_t size = (int64_t)bound.digits.size();
+    std::vector<int64_t> digits(size);
+    while (true) {
+        for (int64_t i = 0; i + 1 < size; ++i) {
+            digits[i] = uniform(UInt::BASE);
+        }
+        digits[size-1] = uniform(bound.digits.back() + 1);
+        UInt res(digits);
+        if (res < bound) return res;
+    }
+}
+
+ChaCha20Rng& thread_rng() {
+    thread_local ChaCha20Rng rng;
+    return rng;
+}
+
+// Арифметика по нечётному модулю меньше 2^63 в форме Монтгомери (R = 2^64):
+// умножение по модулю обходится без деления, только умножениями и сдвигами.
+struct Montgomery64 {
+    using Residue = uint64_t;
+
+    uint64_t mod; // Модуль
+    uint64_t inv; // -mod^(-1) mod 2^64
+    uint64_t r2;  // R^2 mod mod
+
+    explicit Montgomery64(uint64_t mod);
+
+    uint64_t reduce(unsigned __int128 t) const; // t * R^(-1) mod mod при t < mod * 2^64
+    uint64_t to_mont(uint64_t a) const { return reduce((unsigned __int128)a * r2); }
+    uint64_t to_mont(const UInt& a) const { return to_mont((uint64_t)(a % (int64_t)mod)); }
+    uint64_t from_mont(uint64_t a) const { return reduce(a); }
+    uint64_t mont_mul(uint64_t a, uint64_t b) const { return reduce((unsigned __int128)a * b); }
+    uint64_t mont_sqr(uint64_t a) const { return mont_mul(a, a); }
+    uint64_t one() const { return to_mont(1); }
+    uint64_t mont_pow(uint64_t a, uint64_t n) const; // Степень числа в форме Монтгомери
+    uint64_t inverse(uint64_t a) const; // Обратный элемент в форме Монтгомери (a взаимно просто с модулем)
+
+    uint64_t mul(uint64_t a, uint64_t b) const; // Произведение по модулю (обычная форма)
+    uint64_t pow(uint64_t a, uint64_t n) const; // Степень по модулю (обычная форма)
+};
+
+void batch_inverse(const Montgomery64& mod, uint64_t* values, int64_t n); // Обращение n элементов сразу
+
+Montgomery64::Montgomery64(uint64_t mod) : mod(mod) {
+    assert(mod % 2 == 1 && mod < (1ULL << 63));
+    // Обратное по модулю 2^64 методом Ньютона: каждый шаг удваивает число верных бит
+    uint64_t x = mod;
+    for (int64_t i = 0; i < 5; ++i) x *= 2 - mod * x;
+    inv = -x;
+    const uint64_t r1 = -mod % mod;
+    r2 = (uint64_t)((unsigned __int128)r1 * r1 % mod);
+}
+
+uint64_t Montgomery64::reduce(unsigned __int128 t) const {
+    const uint64_t m = (uint64_t)t * inv;
+    const uint64_t res = (uint64_t)((t + (unsigned __int128)m * mod) >> 64);
+    return res >= mod ? res - mod : res;
+}
+
+uint64_t Montgomery64::mul(uint64_t a, uint64_t b) const {
+    return from_mont(mont_mul(to_mont(a), to_mont(b)));
+}
+
+uint64_t Montgomery64::mont_pow(uint64_t a, uint64_t n) const {
+    uint64_t res = one();
+    while (n > 0) {
+        if (n % 2 != 0) res = mont_mul(res, a);
+        a = mont_mul(a, a);
+        n /= 2;
+    }
+    return res;
+}
+
+uint64_t Montgomery64::pow(uint64_t a, uint64_t n) const {
+    return from_mont(mont_pow(to_mont(a), n));
+}
+
+// Обратный элемент расширенным алгоритмом Евклида (из формы Монтгомери aR получается a^(-1)R):
+uint64_t Montgomery64::inverse(uint64_t a) const {
+    int64_t r0 = (int64_t)mod, r1 = (int64_t)from_mont(a);
+    int64_t s0 = 0, s1 = 1;
+    while (r1 != 0) {
+        const int64_t q = r0 / r1;
+        std::tie(r0, r1) = std::make_pair(r1, r0 - q * r1);
+        std::tie(s0, s1) = std::make_pair(s1, s0 - q * s1);
+    }
+    assert(r0 == 1);
+    return to_mont(s0 < 0 ? (uint64_t)(s0 + (int64_t)mod) : (uint64_t)s0);
+}
+
+// Приём Монтгомери: префиксные произведения, одно обращение их полного произведения
+// и обратный проход, итого одно обращение и 3(n-1) умножений. Элементы в форме Монтгомери, ненулевые.
+void batch_inverse(const Montgomery64& mod, uint64_t* values, int64_t n) {
+    if (n == 0) return;
+    std::vector<uint64_t> prefix(n);
+    prefix[0] = values[0];
+    for (int64_t i = 1; i < n; ++i) {
+        prefix[i] = mod.mont_mul(prefix[i-1], values[i]);
+    }
+    uint64_t inv = mod.inverse(prefix[n-1]);
+    for (int64_t i = n - 1; i > 0; --i) {
+        const uint64_t value = values[i];
+        values[i] = mod.mont_mul(inv, prefix[i-1]);
+        inv = mod.mont_mul(inv, value);
+    }
+    values[0] = inv;
+}
+
+// Длинные модули. Все три движка (Montgomery64, FixedMontgomery<Bits>, Montgomery) устроены одинаково:
+// тип вычета Residue, to_mont/from_mont, mont_mul, mont_sqr и one, поэтому возведение в степень с длинным
+// показателем (window_pow) и выбор движка по длине модуля (with_montgomery, pow_mod) написаны один раз.
+
+// Число фиксированной длины: цифры по основанию UInt::BASE лежат в массиве на стеке, их количество
+// известно при компиляции, поэтому циклы по цифрам компилятор разворачивает целиком.
+template <int64_t Bits>
+struct FixedUInt {
+    // ceil(количество десятичных цифр 2^Bits / WIDTH):
+    static constexpr int64_t LIMBS = (Bits * 30103 / 100000 + UInt::WIDTH) / UInt::WIDTH;
+
+    std::array<int64_t, LIMBS> digits{}; // Младшая цифра первая
+
+    FixedUInt() = default;
+    explicit FixedUInt(const UInt& number); // number < BASE^LIMBS
+
+    UInt to_uint() const;
+    int64_t compare(const FixedUInt& other) const;
+    bool operator==(const FixedUInt& other) const { return digits == other.digits; }
+};
+
+// Арифметика Монтгомери по модулю длины до Bits бит (R = BASE^LIMBS), модуль взаимно прост с BASE.
+// Умножение - тот же столбик, что и в UInt::slow_mult, совмещённый с редукцией (CIOS).
+template <int64_t Bits>
+struct FixedMontgomery {
+    using Residue = FixedUInt<Bits>;
+    static constexpr int64_t N = Residue::LIMBS;
+
+    Residue mod;
+    int64_t inv; // -mod^(-1) mod BASE
+    Residue r2;  // R^2 mod mod
+
+    explicit FixedMontgomery(const UInt& mod);
+
+    Residue mont_mul(const Residue& a, const Residue& b) const { return multiply<false>(a, b); }
+    Residue mont_sqr(const Residue& a) const { return multiply<true>(a, a); }
+    Residue to_mont(const UInt& a) const { return mont_mul(Residue(a % mod.to_uint()), r2); }
+    UInt from_mont(const Residue& a) const;
+    Residue one() const { return to_mont(UInt(1)); }
+
+private:
+    template <bool Square>
+    Residue multiply(const Residue& a, const Residue& b) const; // При Square b совпадает с a
+};
+
+// Арифметика Монтгомери над UInt для модулей длиннее стандартных длин ключей (R = BASE^size).
+struct Montgomery {
+    using Residue = UInt;
+
+    UInt mod;
+    int64_t size; // Количество цифр модуля
+    UInt inv;     // -mod^(-1) mod R
+    UInt r2;      // R^2 mod mod
+
+    explicit Montgomery(const UInt& mod);
+
+    UInt reduce(const UInt& t) const; // t * R^(-1) mod mod при t < mod * R
+    UInt mont_mul(const UInt& a, const UInt& b) const { return reduce(a * b); }
+    UInt mont_sqr(const UInt& a) const { return reduce(a * a); }
+    UInt to_mont(const UInt& a) const { return mont_mul(a % mod, r2); }
+    UInt from_mont(const UInt& a) const { return reduce(a); }
+    UInt one() const { return to_mont(UInt(1)); }
+};
+
+template <typename Engine>
+typename Engine::Residue window_pow(const Engine& engine, const typename Engine::Residue& a, const UInt& n);
+template <typename Body>
+void with_montgomery(const UInt& mod, const Body& body); // body(engine) для движка, подходящего к модулю
+UInt pow_mod(const UInt& a, const UInt& n, const UInt& mod); // a^n mod mod с выбором движка по длине модуля
+
+template <int64_t Bits>
+FixedUInt<Bits>::FixedUInt(const UInt& number) {
+    assert(number.digits.size() <= LIMBS);
+    std::copy(number.digits.begin(), number.digits.end(), digits.begin());
+}
+
+template <int64_t Bits>
+UInt FixedUInt<Bits>::to_uint() const {
+    return UInt(LimbVector(digits.data(), digits.data() + LIMBS));
+}
+
+template <int64_t Bits>
+int64_t FixedUInt<Bits>::compare(const FixedUInt& other) const {
+    for (int64_t i = LIMBS - 1; i >= 0; --i) {
+        if (digits[i] != other.digits[i]) return digits[i] > other.digits[i] ? 1 : -1;
+    }
+    return 0;
+}
+
+// Обратное к a по модулю m > 1 расширенным алгоритмом Евклида (a взаимно просто с m):
+static int64_t inverse_mod(int64_t a, int64_t m) {
+    int64_t r0 = m, r1 = a % m;
+    int64_t s0 = 0, s1 = 1;
+    while (r1 != 0) {
+        const int64_t q = r0 / r1;
+        std::tie(r0, r1) = std::make_pair(r1, r0 - q * r1);
+        std::tie(s0, s1) = std::make_pair(s1, s0 - q * s1);
+    }
+    assert(r0 == 1);
+    return s0 < 0 ? s0 + m : s0;
+}
+
+template <int64_t Bits>
+FixedMontgomery<Bits>::FixedMontgomery(const UInt& modulus) : mod(modulus) {
+    assert(modulus.digits[0] % 2 != 0 && modulus.digits[0] % 5 != 0);
+    inv = UInt::BASE - inverse_mod(modulus.digits[0], UInt::BASE);
+    r2 = Residue(UInt(1).shifted(2 * N) % modulus);
+}
+
+// Произведение собирается по столбцам (product scanning): столбец k - сумма a[i] * b[k-i] и m[i] * mod[k-i].
+// Множитель m[k] подбирается, когда столбец k уже сложен, так что его младшая цифра обнуляется; старшие
+// N столбцов и дают результат. Произведения цифр (меньше BASE^2 < 2^60) складываются в uint64_t пачками
+// по COLUMN_CHUNK без переносов, и на пачку приходится одно деление на BASE - умножения не ждут друг друга,
+// в отличие от построчного столбика, где каждый шаг ждёт перенос предыдущего. При возведении в квадрат
+// a[i] * a[k-i] и a[k-i] * a[i] совпадают: каждое такое произведение считается один раз и удваивается,
+// что экономит четверть умножений.
+template <int64_t Bits>
+template <bool Square>
+typename FixedMontgomery<Bits>::Residue FixedMontgomery<Bits>::multiply(const Residue& a, const Residue& b) const {
+    const uint64_t BASE = UInt::BASE;
+    const int64_t COLUMN_CHUNK = 8; // 2 * 8 * BASE^2 < 2^64
+    std::array<uint64_t, N> m{};    // m[k] ещё равно 0, пока складывается столбец k
+    Residue res;
+    uint64_t high = 0, low = 0;     // Столбец равен high * BASE + low
+    for (int64_t k = 0; k < 2 * N; ++k) {
+        const int64_t from = std::max<int64_t>(0, k - N + 1), to = std::min<int64_t>(k, N - 1) + 1;
+        if (Square) {
+            // Пара j, k - j при j < k - j: одно произведение a[j] * a[k-j] вдвое и оба слагаемых редукции
+            const int64_t middle = std::min(to, (k + 1) / 2);
+            for (int64_t i = from; i < middle; i += COLUMN_CHUNK / 2) {
+                const int64_t end = std::min(middle, i + COLUMN_CHUNK / 2);
+                uint64_t sum = 0;
+                for (int64_t j = i; j < end; ++j) {
+                    sum += 2 * (uint64_t)a.digits[j] * (uint64_t)a.digits[k-j]
+                         + m[j] * (uint64_t)mod.digits[k-j] + m[k-j] * (uint64_t)mod.digits[j];
+                }
+                high += sum / BASE;
+                low += sum % BASE;
+            }
+            if (k % 2 == 0) {
+                const uint64_t sum = (uint64_t)a.digits[k/2] * (uint64_t)a.digits[k/2] + m[k/2] * (uint64_t)mod.digits[k/2];
+                high += sum / BASE;
+                low += sum % BASE;
+            }
+        } else {
+            for (int64_t i = from; i < to; i += COLUMN_CHUNK) {
+                const int64_t end = std::min(to, i + COLUMN_CHUNK);
+                uint64_t sum = 0;
+                for (int64_t j = i; j < end; ++j) {
+                    sum += (uint64_t)a.digits[j] * (uint64_t)b.digits[k-j] + m[j] * (uint64_t)mod.digits[k-j];
+                }
+                high += sum / BASE;
+                low += sum % BASE;
+            }
+        }
+        high += low / BASE;
+        low %= BASE;
+        if (k < N) {
+            m[k] = low * (uint64_t)inv % BASE;
+            high += (low + m[k] * (uint64_t)mod.digits[0]) / BASE; // Младшая цифра обнулилась
+        } else {
+            res.digits[k - N] = (int64_t)low;
+        }
+        low = high % BASE; // Перенос в следующий столбец
+        high /= BASE;
+    }
+    // Результат меньше 2 * mod; low - цифра BASE^N, при ней вычитание mod идёт по модулю BASE^N
+    if (low != 0 || res.compare(mod) >= 0) {
+        int64_t rem = 0;
+        for (int64_t i = 0; i < N; ++i) {
+            rem += res.digits[i] - mod.digits[i];
+            res.digits[i] = rem < 0 ? rem + (int64_t)BASE : rem;
+            rem = rem < 0 ? -1 : 0;
+        }
+    }
+    return res;
+}
+
+template <int64_t Bits>
+UInt FixedMontgomery<Bits>::from_mont(const Residue& a) const {
+    Residue unit;
+    unit.digits[0] = 1;
+    return mont_mul(a, unit).to_uint();
+}
+
+// -mod^(-1) mod R: обратное по модулю BASE уточняется шагами Ньютона x = x * (2 - mod * x),
+// каждый из которых удваивает количество верных цифр.
+Montgomery::Montgomery(const UInt& modulus) : mod(modulus), size((int64_t)modulus.digits.size()) {
+    assert(mod.digits[0] % 2 != 0 && mod.digits[0] % 5 != 0);
+    UInt x(inverse_mod(mod.digits[0], UInt::BASE));
+    for (int64_t known = 1; known < size; known *= 2) {
+        const int64_t next = std::min(2 * known, size);
+        const UInt correction = UInt(1).shifted(next) + 2 - (mod.low_digits(next) * x).low_digits(next);
+        x = (x * correction.low_digits(next)).low_digits(next);
+    }
+    inv = UInt(1).shifted(size) - x;
+    r2 = UInt(1).shifted(2 * size) % mod;
+}
+
+UInt Montgomery::reduce(const UInt& t) const {
+    const UInt m = (t.low_digits(size) * inv).low_digits(size);
+    UInt res = (t + m * mod).shifted(-size);
+    if (res >= mod) res -= mod;
+    return res;
+}
+
+// Степень в форме Монтгомери: показатель переводится в систему по основанию 2^30 и обрабатывается
+// окнами по POW_WINDOW бит, так что на каждые POW_WINDOW возведений в квадрат приходится одно умножение.
+static const int64_t POW_WINDOW = 5;
+
+template <typename Engine>
+typename Engine::Residue window_pow(const Engine& engine, const typename Engine::Residue& a, const UInt& n) {
+    using Residue = typename Engine::Residue;
+    std::vector<Residue> table(1 << POW_WINDOW);
+    table[0] = engine.one();
+    for (int64_t i = 1; i < (int64_t)table.size(); ++i) {
+        table[i] = engine.mont_mul(table[i-1], a);
+    }
+    const std::vector<int64_t> words = to_digits(n, 1 << 30);
+    Residue res = table[0];
+    bool started = false;
+    for (int64_t w = (int64_t)words.size() - 1; w >= 0; --w) {
+        for (int64_t shift = 30 - POW_WINDOW; shift >= 0; shift -= POW_WINDOW) {
+            if (started) {
+                for (int64_t k = 0; k < POW_WINDOW; ++k) res = engine.mont_sqr(res);
+            }
+            const int64_t window = (words[w] >> shift) & ((1 << POW_WINDOW) - 1);
+            if (window != 0) {
+                res = started ? engine.mont_mul(res, table[window]) : table[window];
+                started = true;
+            }
+        }
+    }
+    return res;
+}
+
+// Движки для стандартных длин ключей выбираются по количеству цифр модуля,
+// более длинные модули обрабатываются Montgomery над UInt. Промежуточные длины (384, 768, 1536)
+// - делители модулей многопростого RSA из трёх простых.
+template <typename Body>
+void with_montgomery(const UInt& mod, const Body& body) {
+    const int64_t size = (int64_t)mod.digits.size();
+    if (size <= FixedUInt<256>::LIMBS) {
+        body(FixedMontgomery<256>(mod));
+    } else if (size <= FixedUInt<384>::LIMBS) {
+        body(FixedMontgomery<384>(mod));
+    } else if (size <= FixedUInt<512>::LIMBS) {
+        body(FixedMontgomery<512>(mod));
+    } else if (size <= FixedUInt<768>::LIMBS) {
+        body(FixedMontgomery<768>(mod));
+    } else if (size <= FixedUInt<1024>::LIMBS) {
+        body(FixedMontgomery<1024>(mod));
+    } else if (size <= FixedUInt<1536>::LIMBS) {
+        body(FixedMontgomery<1536>(mod));
+    } else if (size <= FixedUInt<2048>::LIMBS) {
+        body(FixedMontgomery<2048>(mod));
+    } else if (size <= FixedUInt<3072>::LIMBS) {
+        body(FixedMontgomery<3072>(mod));
+    } else if (size <= FixedUInt<4096>::LIMBS) {
+        body(FixedMontgomery<4096>(mod));
+    } else {
+        body(Montgomery(mod));
+    }
+}
+
+// Значение числа, если оно меньше 2^63, иначе -1:
+static int64_t small_value(const UInt& number) {
+    if (number.digits.size() > 3u) return -1;
+    unsigned __int128 value = 0;
+    for (int64_t i = (int64_t)number.digits.size() - 1; i >= 0; --i) value = value * UInt::BASE + number.digits[i];
+    return value < ((unsigned __int128)1 << 63) ? (int64_t)value : -1;
+}
+
+// Модули меньше 2^63 обрабатываются Montgomery64, модули, не взаимно простые с BASE,
+// - бинарным возведением с делением.
+UInt pow_mod(const UInt& a, const UInt& n, const UInt& mod) {
+    if (mod == 1) return UInt(0);
+    if (mod.digits[0] % 2 == 0 || mod.digits[0] % 5 == 0) {
+        UInt res(1), base = a % mod;
+        for (int64_t word : to_digits(n, 1 << 30)) {
+            for (int64_t bit = 0; bit < 30; ++bit, word >>= 1) {
+                if (word % 2 != 0) res = res * base % mod;
+                base = base * base % mod;
+            }
+        }
+        return res;
+    }
+    const int64_t small = small_value(mod);
+    if (small > 0) {
+        const Montgomery64 engine((uint64_t)small);
+        return UInt((int64_t)engine.from_mont(window_pow(engine, engine.to_mont(a % small), n)));
+    }
+    UInt res;
+    with_montgomery(mod, [&](const auto& engine) {
+        LimbArena arena;
+        res = engine.from_mont(window_pow(engine, engine.to_mont(a), n));
+    });
+    return res;
+}
+
+// Параллельный цикл: отрезок [0, n) делится поровну между потоками, body(begin, end) обрабатывает свою часть.
+// Короткие отрезки (меньше grain элементов на поток) обрабатываются без создания потоков.
+void parallel_for(int64_t n, int64_t grain, const std::function<void(int64_t, int64_t)>& body) {
+    const int64_t hardware = std::max<int64_t>(1, std::thread::hardware_concurrency());
+    const int64_t threads = std::max<int64_t>(1, std::min(hardware, n / std::max<int64_t>(grain, 1)));
+    if (threads == 1) {
+        if (n > 0) body(0, n);
+        return;
+    }
+    std::vector<std::thread> pool;
+    for (int64_t t = 1; t < threads; ++t) {
+        pool.emplace_back(body, n * t / threads, n * (t + 1) / threads);
+    }
+    body(0, n / threads);
+    for (auto& thread : pool) thread.join();
+}
+
+// Ключевой поток сериализуется в little-endian, как и в parse8: байты слов берутся прямо из памяти.
+void chacha20_xor(const std::array<uint32_t, 8>& key, uint64_t stream, uint64_t counter,
+                  const char* in, char* out, int64_t size) {
+    const int64_t STEP = 64 * CHACHA_LANES;
+    parallel_for((size + STEP - 1) / STEP, 256, [&](int64_t begin, int64_t end) {
+        uint32_t words[16 * CHACHA_LANES];
+        for (int64_t i = begin; i < end; ++i) {
+            chacha20_lanes(key, counter + i * CHACHA_LANES, stream, words);
+            const char* keystream = (const char*)words;
+            const int64_t offset = i * STEP, n = std::min(STEP, size - offset);
+            int64_t j = 0;
+            for (; j + 8 <= n; j += 8) {
+                uint64_t a, b;
+                std::memcpy(&a, in + offset + j, 8);
+                std::memcpy(&b, keystream + j, 8);
+                a ^= b;
+                std::memcpy(out + offset + j, &a, 8);
+            }
+            for (; j < n; ++j) out[offset + j] = in[offset + j] ^ keystream[j];
+        }
+    });
+}
+
+// Простые числа:
+bool is_probable_prime(const UInt& n, int64_t rounds); // Тест Миллера - Рабина после пробных делений
+// Случайное простое ровно из bits бит с двумя старшими единичными битами (произведение двух таких
+// чисел имеет ровно 2 * bits бит), для которого accept(p) истинно:
+UInt random_prime(int64_t bits, const std::function<bool(const UInt&)>& accept = nullptr);
+
+// Безопасное простое p = 2q + 1 ровно из bits бит (q - простое):
+UInt random_safe_prime(int64_t bits);
+
+int64_t jacobi(uint64_t a, uint64_t n);     // Символ Якоби (a/n), n нечётно
+int64_t jacobi(uint64_t a, const UInt& n); // То же для длинного n
+
+// Параметры и ключи ElGamal: простое prime, образующая g, закрытый ключ x и открытый key = g^x mod prime.
+// Если order = 0, prime - безопасное простое, g - первообразный корень, x из [2, prime - 2].
+// Иначе g порождает подгруппу простого порядка order, x из [1, order - 1].
+struct ElGamalKey {
+    UInt prime, g, x, key;
+    UInt order;
+};
+
+ElGamalKey generate_elgamal(int64_t bits);
+// Подгруппа порядка q из order_bits бит в (Z/prime)*, prime = k * q + 1 из bits бит. Показатели
+// берутся по модулю q, поэтому возведение в степень в order_bits / bits раз короче, чем по prime.
+ElGamalKey generate_elgamal_subgroup(int64_t bits, int64_t order_bits);
+
+struct RsaKey {
+    UInt n, e, d;             // Модуль, открытая и закрытая экспоненты
+    std::vector<UInt> primes; // Делители модуля
+};
+
+// Многопростой RSA (count > 2 делителей) ускоряет закрытую операцию, но слишком короткие делители
+// упрощают разложение модуля, поэтому их число ограничено в зависимости от длины модуля:
+int64_t rsa_max_primes(int64_t bits);
+RsaKey generate_rsa(int64_t bits, int64_t count = 2, int64_t e = 65537);
+
+// Открытая операция RSA m^e mod n:
+UInt rsa_public(const UInt& m, const UInt& e, const UInt& n);
+
+// Закрытая операция RSA по китайской теореме об остатках: c^d mod n собирается формулой Гарнера
+// из степеней c^(d mod (p_i - 1)) mod p_i, каждая из которых в k^3 раз дешевле полной (k - число делителей).
+struct RsaCrt {
+    std::vector<UInt> primes;       // Делители модуля p_i
+    std::vector<UInt> exponents;    // d mod (p_i - 1)
+    std::vector<UInt> coefficients; // (p_0 * ... * p_(i-1))^(-1) mod p_i
+
+    RsaCrt(const UInt& d, const std::vector<UInt>& primes);
+
+    UInt decrypt(const UInt& c, bool parallel = false) const; // parallel: ветви вычисляются в отдельных потоках
+};
+
+// Пробные деления в is_probable_prime - на простые от 3 до SIEVE_LIMIT:
+const int64_t SIEVE_LIMIT = 1 << 16;
+// Окно кандидатов в sieved_search просеивается простыми до SEARCH_SIEVE_LIMIT: остатки считаются один раз
+// на окно, а каждый отсеянный кандидат экономит возведение в степень.
+const int64_t SEARCH_SIEVE_LIMIT = 1 << 20;
+// Количество нечётных кандидатов, отсеиваемых за один раз:
+const int64_t SIEVE_WINDOW = 1 << 14;
+
+const std::vector<int64_t>& small_primes() {
+    static const std::vector<int64_t> primes = [] {
+        std::vector<int64_t> res;
+        std::vector<char> composite(SEARCH_SIEVE_LIMIT + 1);
+        for (int64_t i = 3; i <= SEARCH_SIEVE_LIMIT; i += 2) {
+            if (composite[i]) continue;
+            res.push_back(i);
+            for (int64_t j = i * i; j <= SEARCH_SIEVE_LIMIT; j += 2 * i) composite[j] = 1;
+        }
+        return res;
+    }();
+    return primes;
+}
+
+// Остатки от деления number на малые простые до limit. Простые объединяются в группы с произведением
+// не больше INT64_MAX / BASE, так что за один проход по цифрам числа получается сразу несколько остатков.
+static void small_residues(const UInt& number, std::vector<int64_t>& residues, int64_t limit) {
+    static const std::vector<std::pair<int64_t, int64_t>> groups = [] { // (произведение, конец группы)
+        std::vector<std::pair<int64_t, int64_t>> res;
+        const auto& primes = small_primes();
+        int64_t product = 1;
+        for (int64_t i = 0; i < (int64_t)primes.size(); ++i) {
+            if (product > INT64_MAX / UInt::BASE / primes[i]) {
+                res.emplace_back(product, i);
+                product = 1;
+            }
+            product *= primes[i];
+        }
+        res.emplace_back(product, (int64_t)primes.size());
+        return res;
+    }();
+    const auto& primes = small_primes();
+    const int64_t count = std::upper_bound(primes.begin(), primes.end(), limit) - primes.begin();
+    residues.resize(count);
+    int64_t i = 0;
+    for (const auto& [product, end] : groups) {
+        if (i >= count) break;
+        const int64_t rem = number % product;
+        for (; i < std::min(end, count); ++i) residues[i] = rem % primes[i];
+    }
+}
+
+// Тест Миллера - Рабина с основаниями bases (n нечётно, engine - арифметика Монтгомери по модулю n):
+template <typename Engine>
+static bool miller_rabin(const Engine& engine, const UInt& n, const std::vector<UInt>& bases) {
+    UInt d = n - 1;
+    int64_t s = 0;
+    while (d % 2 == 0) {
+        d /= 2;
+        ++s;
+    }
+    const auto one = engine.one(), minus_one = engine.to_mont(n - 1);
+    for (const UInt& base : bases) {
+        auto x = window_pow(engine, engine.to_mont(base), d);
+        if (x == one || x == minus_one) continue;
+        bool witness = true;
+        for (int64_t i = 1; i < s && witness; ++i) {
+            x = engine.mont_sqr(x);
+            witness = !(x == minus_one);
+        }
+        if (witness) return false;
+    }
+    return true;
+}
+
+// Проверка нечётного n > 2^16 без пробных делений: до 2^63 - детерминированный набор оснований,
+// дальше - rounds случайных оснований.
+static bool miller_rabin(const UInt& n, int64_t rounds) {
+    const int64_t small = small_value(n);
+    if (small > 0) {
+        // Основания, кратные n, пропускаются
+        std::vector<UInt> bases;
+        for (int64_t base : {2, 325, 9375, 28178, 450775, 9780504, 1795265022}) {
+            if (base % small != 0) bases.emplace_back(base);
+        }
+        return miller_rabin(Montgomery64((uint64_t)small), n, bases);
+    }
+    std::vector<UInt> bases;
+    for (int64_t i = 0; i < rounds; ++i) bases.push_back(thread_rng().uniform(n - 3) + 2);
+    bool res = false;
+    with_montgomery(n, [&](const auto& engine) {
+        res = miller_rabin(engine, n, bases);
+    });
+    return res;
+}
+
+bool is_probable_prime(const UInt& n, int64_t rounds) {
+    if (n < 2) return false;
+    if (n % 2 == 0) return n == 2;
+    const auto& primes = small_primes();
+    if (n <= SIEVE_LIMIT) {
+        return std::binary_search(primes.begin(), primes.end(), small_value(n));
+    }
+    // Для коротких чисел тест дешевле полного набора пробных делений
+    const int64_t small = small_value(n);
+    if (small > 0) {
+        for (int64_t i = 0; primes[i] < 64; ++i) {
+            if (small % primes[i] == 0) return false;
+        }
+        return miller_rabin(n, rounds);
+    }
+    std::vector<int64_t> residues;
+    small_residues(n, residues, SIEVE_LIMIT);
+    if (std::find(residues.begin(), residues.end(), 0) != residues.end()) return false;
+    return miller_rabin(n, rounds);
+}
+
+// Число раундов, при котором случайное число из bits бит, прошедшее тест, составное с вероятностью
+// меньше 2^-100 (оценки Дамгорда - Ландрока - Померанса):
+static int64_t prime_rounds(int64_t bits) {
+    if (bits >= 1300) return 2;
+    if (bits >= 850) return 3;
+    if (bits >= 650) return 4;
+    if (bits >= 350) return 8;
+    if (bits >= 250) return 12;
+    return 40;
+}
+
+// Окно из SIEVE_WINDOW нечётных чисел start + 2k длины bits просеивается простыми p до SEARCH_SIEVE_LIMIT: отбрасываются
+// кандидаты, делящиеся на p, а при safe - ещё и те, для которых на p делится 2 * (start + 2k) + 1.
+// Оставшиеся кандидаты проверяются test. Каждый поток просматривает свои окна, поиск заканчивается
+// на первом кандидате, прошедшем проверку.
+static UInt sieved_search(int64_t bits, bool safe, const std::function<bool(const UInt&)>& test) {
+    assert(bits >= 24);
+    const UInt low = pow(UInt(2), bits - 1) + pow(UInt(2), bits - 2);
+    const UInt span = pow(UInt(2), bits - 2) - 2 * SIEVE_WINDOW;
+    const auto& primes = small_primes();
+    std::atomic<bool> found(false);
+    std::mutex lock;
+    UInt res;
+    const int64_t threads = std::max<int64_t>(1, std::thread::hardware_concurrency());
+    parallel_for(threads, 1, [&](int64_t, int64_t) {
+        ChaCha20Rng& rng = thread_rng();
+        std::vector<int64_t> residues;
+        std::vector<char> composite(SIEVE_WINDOW);
+        while (!found) {
+            UInt start = low + rng.uniform(span);
+            if (start % 2 == 0) start += 1;
+            small_residues(start, residues, SEARCH_SIEVE_LIMIT);
+            std::fill(composite.begin(), composite.end(), 0);
+            for (int64_t i = 0; i < (int64_t)residues.size(); ++i) {
+                // start + 2k = t mod p при k = (t - start) / 2 mod p, здесь t = 0 и t = (p - 1) / 2
+                const int64_t p = primes[i], half = (p + 1) / 2;
+                for (int64_t k = (p - residues[i]) % p * half % p; k < SIEVE_WINDOW; k += p) {
+                    composite[k] = 1;
+                }
+                if (!safe) continue;
+                for (int64_t k = (half - 1 + p - residues[i]) % p * half % p; k < SIEVE_WINDOW; k += p) {
+                    composite[k] = 1;
+                }
+            }
+            for (int64_t k = 0; k < SIEVE_WINDOW && !found; ++k) {
+                if (composite[k]) continue;
+                UInt candidate = start + 2 * k;
+                if (!test(candidate)) continue;
+                std::lock_guard<std::mutex> guard(lock);
+                if (!found) {
+                    res = std::move(candidate);
+                    found = true;
+                }
+            }
+        }
+    });
+    return res;
+}
+
+UInt random_prime(int64_t bits, const std::function<bool(const UInt&)>& accept) {
+    const int64_t rounds = prime_rounds(bits);
+    return sieved_search(bits, false, [&](const UInt& candidate) {
+        return (!accept || accept(candidate)) && miller_rabin(candidate, rounds);
+    });
+}
+
+// Сначала q и p проверяются по одному основанию, что отсеивает почти все составные пары за две степени.
+// Для простого q и p = 2q + 1 из 2^(p-1) = 1 mod p следует простота p (2^2 != 1, так что порядок 2
+// делится на q > sqrt(p) - критерий Поклингтона), поэтому полная проверка нужна только для q.
+UInt random_safe_prime(int64_t bits) {
+    const int64_t rounds = prime_rounds(bits - 1);
+    const UInt q = sieved_search(bits - 1, true, [rounds](const UInt& q) {
+        const UInt p = UInt(2 * q) + 1;
+        return miller_rabin(q, 1) && pow_mod(UInt(2), p - 1, p) == 1 && miller_rabin(q, rounds);
+    });
+    return UInt(2 * q) + 1;
+}
+
+// Символ Якоби (a/n) для нечётного n:
+int64_t jacobi(uint64_t a, uint64_t n) {
+    int64_t res = 1;
+    a %= n;
+    while (a != 0) {
+        while (a % 2 == 0) {
+            a /= 2;
+            if (n % 8 == 3 || n % 8 == 5) res = -res;
+        }
+        std::swap(a, n);
+        if (a % 4 == 3 && n % 4 == 3) res = -res;
+        a %= n;
+    }
+    return n == 1 ? res : 0;
+}
+
+int64_t jacobi(uint64_t a, const UInt& n) {
+    // (2/n) зависит от n mod 8, затем закон взаимности сводит символ к (n mod a / a)
+    int64_t res = 1;
+    const int64_t n8 = n % 8;
+    while (a != 0 && a % 2 == 0) {
+        a /= 2;
+        if (n8 == 3 || n8 == 5) res = -res;
+    }
+    if (a == 0) return n == 1 ? 1 : 0;
+    if (a % 4 == 3 && n8 % 4 == 3) res = -res;
+    return a == 1 ? res : res * jacobi((uint64_t)(n % (int64_t)a), a);
+}
+
+// Для p = 2q + 1 порядок g в (Z/p)* равен 1, 2, q или 2q. Первые два случая - g = 1 и g = p - 1,
+// а порядок q означает, что g - квадратичный вычет (g^q = 1 - критерий Эйлера). Поэтому первообразный
+// корень - любой невычет, и проверка сводится к символу Лежандра без возведения в степень.
+ElGamalKey generate_elgamal(int64_t bits) {
+    ElGamalKey key;
+    key.prime = random_safe_prime(bits);
+    int64_t g = 2;
+    while (jacobi(g, key.prime) != -1) ++g;
+    key.g = UInt(g);
+    key.x = thread_rng().uniform(key.prime - 3) + 2;
+    key.key = pow_mod(key.g, key.x, key.prime);
+    return key;
+}
+
+ElGamalKey generate_elgamal_subgroup(int64_t bits, int64_t order_bits) {
+    assert(order_bits >= 24 && bits >= order_bits + 8);
+    ElGamalKey key;
+    key.order = random_prime(order_bits);
+    // prime = 2 * half * q + 1, где half выбирается так, чтобы в prime было ровно bits бит
+    const UInt twice = 2 * key.order;
+    const UInt low = pow(UInt(2), bits - 1) / twice + 1, high = (pow(UInt(2), bits) - 1) / twice;
+    const int64_t rounds = prime_rounds(bits);
+    do {
+        key.prime = UInt((low + thread_rng().uniform(high - low + 1)) * twice) + 1;
+    } while (!is_probable_prime(key.prime, rounds));
+    const UInt cofactor = (key.prime - 1) / key.order;
+    for (int64_t h = 2; key.g == 0 || key.g == 1; ++h) {
+        key.g = pow_mod(UInt(h), cofactor, key.prime);
+    }
+    key.x = thread_rng().uniform(key.order - 1) + 1;
+    key.key = pow_mod(key.g, key.x, key.prime);
+    return key;
+}
+
+int64_t rsa_max_primes(int64_t bits) {
+    return bits < 1024 ? 2 : bits < 4096 ? 3 : bits < 8192 ? 4 : 5;
+}
+
+// Ключ RSA: модуль n = p_1 * ... * p_count ровно из bits бит (делители почти одинаковой длины),
+// e - открытая экспонента, d = e^(-1) mod lcm(p_i - 1).
+RsaKey generate_rsa(int64_t bits, int64_t count, int64_t e) {
+    assert(count >= 2 && bits >= 24 * count);
+    // Простые p с p mod e = 1 не годятся: тогда e не обратима по модулю p - 1
+    const auto coprime = [e](const UInt& p) { return p % e != 1; };
+    const UInt low = pow(UInt(2), bits - 1);
+    RsaKey key;
+    key.e = UInt(e);
+    key.primes.resize(count);
+    while (true) {
+        key.n = UInt(1);
+        for (int64_t i = 0; i < count; ++i) {
+            key.primes[i] = random_prime(bits / count + (i < bits % count), coprime);
+            key.n *= key.primes[i];
+        }
+        // Для двух делителей длина произведения точна, для большего числа её нужно проверить
+        if (key.n < low) continue;
+        std::vector<UInt> sorted = key.primes;
+        std::sort(sorted.begin(), sorted.end());
+        if (std::adjacent_find(sorted.begin(), sorted.end()) == sorted.end()) break;
+    }
+    UInt lambda(1);
+    for (const UInt& p : key.primes) {
+        const UInt p1 = p - 1;
+        lambda = lambda / gcd(lambda, p1) * p1;
+    }
+    key.d = invmod(key.e, lambda);
+    return key;
+}
+
+// Возведение в короткую степень n > 0 слева направо, без таблицы окон: для e = 65537 это 16 возведений
+// в квадрат и одно умножение вместо 16 умножений на заполнение таблицы в window_pow.
+template <typename Engine>
+static typename Engine::Residue short_pow(const Engine& engine, const typename Engine::Residue& a, uint64_t n) {
+    auto res = a;
+    for (int64_t bit = 62 - __builtin_clzll(n); bit >= 0; --bit) {
+        res = engine.mont_sqr(res);
+        if (n >> bit & 1) res = engine.mont_mul(res, a);
+    }
+    return res;
+}
+
+UInt rsa_public(const UInt& m, const UInt& e, const UInt& n) {
+    const int64_t exponent = small_value(e);
+    if (exponent <= 0 || exponent >= (int64_t)1 << 32) return pow_mod(m, e, n);
+    UInt res;
+    with_montgomery(n, [&](const auto& engine) {
+        LimbArena arena;
+        res = engine.from_mont(short_pow(engine, engine.to_mont(m), (uint64_t)exponent));
+    });
+    return res;
+}
+
+RsaCrt::RsaCrt(const UInt& d, const std::vector<UInt>& primes) : primes(primes) {
+    UInt product(1);
+    for (const UInt& p : primes) {
+        exponents.push_back(d % (p - 1));
+        coefficients.push_back(invmod(product % p, p));
+        product *= p;
+    }
+}
+
+UInt RsaCrt::decrypt(const UInt& c, bool parallel) const {
+    const int64_t k = (int64_t)primes.size();
+    std::vector<UInt> residues(k);
+    const auto branch = [&](int64_t begin, int64_t end) {
+        for (int64_t i = begin; i < end; ++i) residues[i] = pow_mod(c, exponents[i], primes[i]);
+    };
+    if (parallel) {
+        parallel_for(k, 1, branch);
+    } else {
+        branch(0, k);
+    }
+    // Гарнер: res = v_0 + v_1 * p_0 + v_2 * p_0 * p_1 + ..., где v_i = (r_i - res) * coefficients[i] mod p_i
+    UInt res = residues[0], place(1);
+    for (int64_t i = 1; i < k; ++i) {
+        place *= primes[i-1];
+        const UInt current = res % primes[i];
+        UInt v = residues[i] >= current ? residues[i] - current : residues[i] + primes[i] - current;
+        v = v * coefficients[i] % primes[i];
+        res += v * place;
+    }
+    return res;
+}
+
+// Коды символов сообщения: цифры, латинские буквы, пробел и точка получают коды 0..63, остальные символы - 64
+const int64_t SYMBOLS = 65; // Число различных кодов символов
+
+int64_t symbol_code(char symbol) {
+    if (symbol >= 48 && symbol <= 57)
+        return symbol - 48;
+    else if (symbol >= 65 && symbol <= 90)
+        return symbol - 55;
+    else if (symbol >= 97 && symbol <= 122)
+        return symbol - 61;
+    else if (symbol == 32)
+        return 62;
+    else if (symbol == 46)
+        return 63;
+    else
+        return 64;
+}
+
+// Символ по коду (для кода 64 исходный символ неизвестен):
+char symbol_char(int64_t code) {
+    if (code < 10)
+        return (char)(48 + code);
+    else if (code < 36)
+        return (char)(55 + code);
+    else if (code < 62)
+        return (char)(61 + code);
+    else if (code == 62)
+        return ' ';
+    else if (code == 63)
+        return '.';
+    else
+        return '?';
+}
+
+// Способ перевода блока символов в цифры по основанию prime:
+enum class Encoding {
+    Number, // весь блок - одно число в системе по основанию 64, переводимое в систему по основанию prime
+    Packed  // каждая цифра - группа из symbols_per_digit(prime) символов, записанная в системе по основанию SYMBOLS,
+            // плюс 1 (группа из одних '0' не даёт цифру 0, которая шифровалась бы в c2 = 0)
+};
+
+const char* encoding_name(Encoding encoding) {
+    return encoding == Encoding::Packed ? "packed" : "number";
+}
+
+// Количество символов в одной цифре при поблочном кодировании (наибольшее s, при котором SYMBOLS^s + 1 < prime,
+// так что цифра со сдвигом на 1 меньше prime):
+int64_t symbols_per_digit(int64_t prime) {
+    int64_t group = 0;
+    for (int64_t place = 1; place <= (prime - 2) / SYMBOLS; place *= SYMBOLS) {
+        ++group;
+    }
+    return group;
+}
+
+// То же для длинного модуля (наибольшее s, при котором radix^s + 1 < modulus):
+int64_t symbols_per_value(const UInt& modulus, int64_t radix) {
+    int64_t group = 0;
+    for (UInt place = radix; place + 1 < modulus; place *= radix) {
+        ++group;
+    }
+    return group;
+}
+
+// Случайная набивка RSA: группа v из s = rsa_symbols(n) символов шифруется как m = v + SYMBOLS^s * r со
+// случайным r из [1, 2^RSA_PAD_BITS). Тогда 1 < m < n, и одинаковые группы дают разные шифротексты;
+// при расшифровании v = m mod SYMBOLS^s.
+const int64_t RSA_PAD_BITS = 128;
+
+int64_t rsa_symbols(const UInt& modulus) {
+    return symbols_per_value(modulus / pow(UInt(2), RSA_PAD_BITS), SYMBOLS);
+}
+
+// Запись и чтение числа фиксированной ширины (width байт, little-endian):
+void put_le(std::string& out, uint64_t value, int64_t width) {
+    for (int64_t i = 0; i < width; ++i) {
+        out.push_back((char)(value >> (8 * i) & 0xff));
+    }
+}
+
+uint64_t get_le(const char* in, int64_t width) {
+    uint64_t value = 0;
+    for (int64_t i = width - 1; i >= 0; --i) {
+        value = value << 8 | (uint8_t)in[i];
+    }
+    return value;
+}
+
+// Ширина записи вычета в байтах: ceil(log2 prime) бит, округлённые до целого числа байт
+int64_t residue_width(uint64_t prime) {
+    const int64_t bits = 64 - __builtin_clzll(prime);
+    return (bits + 7) / 8;
+}
+
+// Идентификатор открытого ключа: FNV-1a от его записи фиксированной ширины
+uint64_t key_id(uint64_t key, int64_t width) {
+    std::string bytes;
+    put_le(bytes, key, width);
+    uint64_t hash = 14695981039346656037ULL;
+    for (auto byte : bytes) {
+        hash = (hash ^ (uint8_t)byte) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Заголовок двоичного шифротекста (все числа little-endian):
+//   "EGB1", кодирование (1 байт), флаги (1 байт), ширина записи в байтах (2 байта), размер блока (8 байт),
+//   идентификатор ключа (8 байт), prime и g (по ширине записи).
+// Далее идут блоки: количество символов (8 байт), количество пар (8 байт) и пары (c1, c2) по ширине записи.
+struct BinaryHeader {
+    static const int64_t FIXED_SIZE = 24; // Размер заголовка без prime и g
+    static const int64_t BLOCK_HEADER_SIZE = 16;
+    static const uint8_t INDEXED = 1; // Флаг: в конце записано оглавление блоков (ChunkIndex)
+
+    Encoding encoding = Encoding::Number;
+    uint8_t flags = 0;
+    int64_t width = 0;
+    int64_t block_size = 0;
+    uint64_t key = 0; // Идентификатор ключа
+    uint64_t prime = 0, g = 0;
+
+    int64_t size() const { return FIXED_SIZE + 2 * width; }
+    std::string serialize() const;
+    bool parse(const char* data, int64_t available); // false, если заголовок повреждён или не помещается в data
+};
+
+std::string BinaryHeader::serialize() const {
+    std::string out = "EGB1";
+    out.push_back(encoding == Encoding::Packed ? 1 : 0);
+    out.push_back((char)flags);
+    put_le(out, width, 2);
+    put_le(out, block_size, 8);
+    put_le(out, key, 8);
+    put_le(out, prime, width);
+    put_le(out, g, width);
+    return out;
+}
+
+bool BinaryHeader::parse(const char* data, int64_t available) {
+    if (available < FIXED_SIZE || std::string(data, 4) != "EGB1" || (uint8_t)data[4] > 1) return false;
+    encoding = data[4] == 1 ? Encoding::Packed : Encoding::Number;
+    flags = (uint8_t)data[5];
+    width = (int64_t)get_le(data + 6, 2);
+    block_size = (int64_t)get_le(data + 8, 8);
+    key = get_le(data + 16, 8);
+    if (width <= 0 || width > 8 || available < size()) return false;
+    prime = get_le(data + FIXED_SIZE, width);
+    g = get_le(data + FIXED_SIZE + width, width);
+    return true;
+}
+
+// Оглавление контейнера (флаг BinaryHeader::INDEXED). После последнего блока записывается
+// блок-терминатор (16 байт 0xff), затем для каждого блока смещение от начала файла, длина в байтах,
+// количество символов и количество пар (по 8 байт), и в конце смещение оглавления,
+// количество блоков (по 8 байт) и "EGIX". Любой блок можно прочитать и расшифровать независимо от остальных.
+struct ChunkIndex {
+    static const int64_t ENTRY_SIZE = 32;
+    static const int64_t FOOTER_SIZE = 20;
+
+    int64_t offset = 0, length = 0, symbols = 0, pairs = 0;
+};
+
+std::string serialize_index(const std::vector<ChunkIndex>& index, int64_t index_offset) {
+    std::string out(BinaryHeader::BLOCK_HEADER_SIZE, '\xff');
+    for (const auto& chunk : index) {
+        put_le(out, chunk.offset, 8);
+        put_le(out, chunk.length, 8);
+        put_le(out, chunk.symbols, 8);
+        put_le(out, chunk.pairs, 8);
+    }
+    put_le(out, index_offset + BinaryHeader::BLOCK_HEADER_SIZE, 8);
+    put_le(out, index.size(), 8);
+    return out + "EGIX";
+}
+
+// Чтение оглавления с конца потока (поток должен поддерживать позиционирование). Числа из файла
+// проверяются до выделения памяти и перемещений: оглавление должно занимать ровно конец файла, а каждый
+// блок - лежать между заголовком и терминатором. false, если оглавление повреждено.
+bool read_index(std::istream& is, std::vector<ChunkIndex>& index) {
+    char footer[ChunkIndex::FOOTER_SIZE];
+    if (!is.seekg(0, std::ios::end)) return false;
+    const int64_t file_size = (int64_t)is.tellg();
+    const int64_t payload_begin = BinaryHeader::FIXED_SIZE;
+    if (file_size < payload_begin + BinaryHeader::BLOCK_HEADER_SIZE + ChunkIndex::FOOTER_SIZE
+        || !is.seekg(-ChunkIndex::FOOTER_SIZE, std::ios::end) || !is.read(footer, ChunkIndex::FOOTER_SIZE)
+        || std::string(footer + 16, 4) != "EGIX") return false;
+    const uint64_t offset = get_le(footer, 8);
+    const uint64_t count = get_le(footer + 8, 8);
+    const uint64_t entries_end = file_size - ChunkIndex::FOOTER_SIZE;
+    if (count > (entries_end - payload_begin - BinaryHeader::BLOCK_HEADER_SIZE) / ChunkIndex::ENTRY_SIZE
+        || offset != entries_end - ChunkIndex::ENTRY_SIZE * count) return false;
+    const int64_t payload_end = (int64_t)offset - BinaryHeader::BLOCK_HEADER_SIZE; // Начало терминатора
+    std::string entries(ChunkIndex::ENTRY_SIZE * count, '\0');
+    if (!is.seekg(offset) || !is.read(&entries[0], entries.size())) return false;
+    index.resize(count);
+    for (int64_t i = 0; i < (int64_t)count; ++i) {
+        const char* entry = entries.data() + ChunkIndex::ENTRY_SIZE * i;
+        index[i].offset = (int64_t)get_le(entry, 8);
+        index[i].length = (int64_t)get_le(entry + 8, 8);
+        index[i].symbols = (int64_t)get_le(entry + 16, 8);
+        index[i].pairs = (int64_t)get_le(entry + 24, 8);
+        // В паре не больше 11 символов (64^11 > 2^63), в записи пары не меньше 2 байт
+        const ChunkIndex& chunk = index[i];
+        if (chunk.offset < payload_begin || chunk.offset > payload_end || chunk.length < BinaryHeader::BLOCK_HEADER_SIZE
+            || chunk.length > payload_end - chunk.offset || chunk.pairs < 0 || chunk.pairs > chunk.length / 2
+            || chunk.symbols < 0 || chunk.symbols > 11 * chunk.pairs) {
+            index.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+// Источник входных байт без лишних копий: обычный файл целиком отображается в память (mmap),
+// канал или терминал читается крупными блоками в выровненный буфер. Данные доступны как непрерывный
+// фрагмент [data(), data() + available()), который остаётся верным до следующего вызова fill().
+struct InputSource {
+    static const int64_t BLOCK = 1 << 20; // Размер одного чтения
+    static const int64_t ALIGN = 4096;
+
+    explicit InputSource(int fd);
+    ~InputSource();
+    InputSource(const InputSource&) = delete;
+    InputSource& operator=(const InputSource&) = delete;
+
+    bool fill(int64_t n); // Добиться, чтобы было доступно хотя бы n байт (false, если ввод кончился раньше)
+    const char* data() const { return begin; }
+    int64_t available() const { return end - begin; }
+    void consume(int64_t n) { begin += n; }
+
+    bool read_token(std::string& token);      // Очередное слово (пробельные символы пропускаются)
+    bool read_line_token(std::string& token); // То же, но только если слово есть в текущей строке
+    bool read_number(uint64_t& value);        // Очередное десятичное число (parse_u64)
+    int64_t line_length();                    // Длина текущей строки без '\n' (строка целиком становится доступной)
+
+private:
+    int fd;
+    char* mapping = nullptr; // Отображение файла
+    int64_t mapping_size = 0;
+    char* buffer = nullptr;  // Буфер для чтения из канала
+    int64_t capacity = 0;
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    bool eof = false;
+};
+
+InputSource::InputSource(int fd) : fd(fd) {
+    struct stat info;
+    const off_t position = lseek(fd, 0, SEEK_CUR);
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && position >= 0 && info.st_size > position) {
+        void* map = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, info.st_size, MADV_SEQUENTIAL);
+            mapping = (char*)map;
+            mapping_size = info.st_size;
+            begin = mapping + position;
+            end = mapping + mapping_size;
+            eof = true;
+            return;
+        }
+    }
+    begin = end = buffer;
+}
+
+InputSource::~InputSource() {
+    if (mapping != nullptr) munmap(mapping, mapping_size);
+    free(buffer);
+}
+
+bool InputSource::fill(int64_t n) {
+    while (available() < n && !eof) {
+        // Оставшиеся данные переносятся в начало буфера, при нехватке места буфер увеличивается - не сразу
+        // до n, а вдвое, по мере прихода данных (n может прийти из повреждённого заголовка)
+        const int64_t rest = available();
+        const int64_t needed = std::max(std::min(n, capacity > 0 ? 2 * capacity : BLOCK), rest + BLOCK);
+        if (needed > capacity) {
+            const int64_t size = (needed + ALIGN - 1) / ALIGN * ALIGN;
+            void* memory = nullptr;
+            if (posix_memalign(&memory, ALIGN, size) != 0) throw std::bad_alloc();
+            if (rest > 0) std::memcpy(memory, begin, rest);
+            free(buffer);
+            buffer = (char*)memory;
+            capacity = size;
+        } else if (begin != buffer) {
+            std::memmove(buffer, begin, rest);
+        }
+        begin = buffer;
+        end = buffer + rest;
+        const ssize_t got = read(fd, buffer + rest, capacity - rest);
+        if (got <= 0) {
+            eof = true;
+        } else {
+            end += got;
+        }
+    }
+    return available() >= n;
+}
+
+bool InputSource::read_token(std::string& token) {
+    token.clear();
+    while (true) {
+        while (begin != end && std::isspace((unsigned char)*begin)) ++begin;
+        if (begin != end || !fill(1)) break;
+    }
+    while (true) {
+        while (begin != end && !std::isspace((unsigned char)*begin)) token.push_back(*begin++);
+        if (begin != end || !fill(1)) break;
+    }
+    return !token.empty();
+}
+
+bool InputSource::read_line_token(std::string& token) {
+    token.clear();
+    while (true) {
+        while (begin != end && *begin != '\n' && std::isspace((unsigned char)*begin)) ++begin;
+        if (begin != end || !fill(1)) break;
+    }
+    return begin != end && *begin != '\n' && read_token(token);
+}
+
+bool InputSource::read_number(uint64_t& value) {
+    while (true) {
+        while (begin != end && std::isspace((unsigned char)*begin)) ++begin;
+        if (begin != end || !fill(1)) break;
+    }
+    fill(32); // Число целиком (не длиннее 20 цифр) оказывается в буфере
+    const char* next = parse_u64(begin, end, value);
+    if (next == begin || (next != end && !std::isspace((unsigned char)*next))) return false; // Не число или "12ab"
+    begin = next;
+    return true;
+}
+
+int64_t InputSource::line_length() {
+    int64_t scanned = 0;
+    while (true) {
+        const void* newline = std::memchr(begin + scanned, '\n', available() - scanned);
+        if (newline != nullptr) return (const char*)newline - begin;
+        scanned = available();
+        if (!fill(scanned + 1)) return available();
+    }
+}
+
+// Асинхронный вывод с двойной буферизацией: submit() отдаёт заполненный буфер на запись и сразу
+// возвращает пустой (с сохранённой ёмкостью), так что следующая порция вычисляется, пока пишется предыдущая.
+// Запись идёт через io_uring, а если ядро его не поддерживает - в отдельном потоке.
+struct AsyncWriter {
+    explicit AsyncWriter(int fd);
+    ~AsyncWriter();
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+    void submit(std::string& data); // Начать запись data; data заменяется пустым буфером
+    void wait();                    // Дождаться окончания начатой записи
+    bool failed() const { return error; }
+
+private:
+    bool setup_uring();
+    bool uring_write(const char* data, int64_t size); // Отправка запроса на запись (false, если он не принят)
+    int64_t uring_complete();                         // Ожидание результата запроса (байты или -errno)
+    void write_rest();                                // Дописать остаток pending обычным write
+    static bool write_all(int fd, const char* data, int64_t size);
+
+    int fd;
+    std::string pending; // Записываемый буфер
+    bool busy = false;   // Есть незавершённая запись
+    bool error = false;
+
+    // io_uring:
+    static const int64_t URING_LOST = INT64_MIN; // uring_complete: отказало само кольцо, судьба запроса неизвестна
+    static const int URING_RETRIES = 64;         // Сколько раз подряд повторять запрос, который ядро не приняло
+                                                 // или который ничего не записал
+    int ring = -1;
+    bool ring_failed = false; // В кольце мог остаться неотправленный запрос: кольцо больше не используется
+    unsigned *sq_head = nullptr, *sq_tail = nullptr, *sq_mask = nullptr, *sq_array = nullptr;
+    unsigned *cq_head = nullptr, *cq_tail = nullptr, *cq_mask = nullptr;
+    void* sqes = nullptr;
+    void* cqes = nullptr;
+    void* sq_ring = nullptr;
+    void* cq_ring = nullptr;
+    size_t sq_ring_size = 0, cq_ring_size = 0, sqes_size = 0;
+    int64_t offset = 0; // Уже записанная часть pending
+    int retries = 0;    // Подряд идущие пустые записи (0 байт, -EINTR, -EAGAIN)
+
+    // Поток записи:
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stop = false;
+};
+
+AsyncWriter::AsyncWriter(int fd) : fd(fd) {
+    if (setup_uring()) return;
+    worker = std::thread([this] {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [this] { return busy || stop; });
+            if (!busy) break;
+            lock.unlock();
+            const bool ok = write_all(this->fd, pending.data(), (int64_t)pending.size());
+            lock.lock();
+            error = error || !ok;
+            busy = false;
+            cv.notify_all();
+        }
+    });
+}
+
+AsyncWriter::~AsyncWriter() {
+    wait();
+    if (worker.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv.notify_all();
+        worker.join();
+    }
+    if (ring >= 0) {
+        munmap(sqes, sqes_size);
+        if (cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+        munmap(sq_ring, sq_ring_size);
+        close(ring);
+    }
+}
+
+void AsyncWriter::submit(std::string& data) {
+    wait();
+    pending.swap(data);
+    data.clear();
+    if (pending.empty()) return;
+    if (ring >= 0) {
+        offset = 0;
+        retries = 0;
+        busy = uring_write(pending.data(), (int64_t)pending.size());
+        if (!busy) write_rest();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        busy = true;
+    }
+    cv.notify_all();
+}
+
+void AsyncWriter::wait() {
+    if (ring < 0) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return !busy; });
+        return;
+    }
+    while (busy) {
+        const int64_t res = uring_complete();
+        busy = false;
+        if (res == URING_LOST) {
+            // Запрос, возможно, ещё выполняется: дописывать за ним остаток нельзя
+            ring_failed = true;
+            error = true;
+        } else if (res >= 0 || res == -EINTR || res == -EAGAIN) {
+            // Неполная или пустая запись: остаток отправляется заново
+            if (res > 0) {
+                offset += res;
+                retries = 0;
+            } else {
+                ++retries;
+            }
+            if (offset == (int64_t)pending.size()) break;
+            busy = retries < URING_RETRIES && uring_write(pending.data() + offset, (int64_t)pending.size() - offset);
+            if (!busy) write_rest();
+        } else {
+            // Запрос завершился ошибкой: остаток дописывается обычным write (он и сообщит об ошибке)
+            write_rest();
+        }
+    }
+}
+
+void AsyncWriter::write_rest() {
+    error = error || !write_all(fd, pending.data() + offset, (int64_t)pending.size() - offset);
+    offset = (int64_t)pending.size();
+}
+
+bool AsyncWriter::write_all(int fd, const char* data, int64_t size) {
+    while (size > 0) {
+        const ssize_t got = write(fd, data, size);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        data += got;
+        size -= got;
+    }
+    return true;
+}
+
+#ifdef HAVE_IO_URING
+// Кольца io_uring настраиваются напрямую системными вызовами (liburing не нужна).
+// Запись идёт с текущей позиции файла (offset = -1), что требует IORING_FEAT_RW_CUR_POS.
+bool AsyncWriter::setup_uring() {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    const int fd_ring = (int)syscall(__NR_io_uring_setup, 2, &params);
+    if (fd_ring < 0) return false;
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(fd_ring);
+        return false;
+    }
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_ring, IORING_OFF_SQ_RING);
+    cq_ring = single ? sq_ring
+                     : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_ring, IORING_OFF_CQ_RING);
+    sqes = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_ring, IORING_OFF_SQES);
+    if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+        if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+        close(fd_ring);
+        return false;
+    }
+    char* sq = (char*)sq_ring;
+    char* cq = (char*)cq_ring;
+    sq_head = (unsigned*)(sq + params.sq_off.head);
+    sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    sq_array = (unsigned*)(sq + params.sq_off.array);
+    cq_head = (unsigned*)(cq + params.cq_off.head);
+    cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = cq + params.cq_off.cqes;
+    ring = fd_ring;
+    return true;
+}
+
+// Опубликованный запрос отозвать нельзя (ядро может забрать его в любой момент), поэтому io_uring_enter
+// повторяется, пока ядро не примет запрос (по числу отправленных или по сдвигу sq_head). Если кольцо
+// отказало окончательно, оно больше не используется, и оставшийся в нём запрос никогда не будет отправлен.
+bool AsyncWriter::uring_write(const char* data, int64_t size) {
+    if (ring_failed) return false;
+    const unsigned tail = *sq_tail;
+    const unsigned index = tail & *sq_mask;
+    io_uring_sqe* sqe = (io_uring_sqe*)sqes + index;
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)data;
+    sqe->len = (uint32_t)std::min<int64_t>(size, 1 << 30);
+    sqe->off = (uint64_t)-1;
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    for (int attempt = 0; attempt < URING_RETRIES;) {
+        const long submitted = syscall(__NR_io_uring_enter, ring, 1, 0, 0, nullptr, 0);
+        if (submitted > 0 || __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == tail + 1) return true;
+        if (submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) break;
+        if (submitted == 0 || errno != EINTR) ++attempt;
+    }
+    ring_failed = true;
+    return false;
+}
+
+int64_t AsyncWriter::uring_complete() {
+    while (true) {
+        const unsigned head = *cq_head;
+        if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+            const int64_t res = ((io_uring_cqe*)cqes)[head & *cq_mask].res;
+            __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+            return res;
+        }
+        if (syscall(__NR_io_uring_enter, ring, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0
+            && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return URING_LOST;
+        }
+    }
+}
+#else
+bool AsyncWriter::setup_uring() { return false; }
+bool AsyncWriter::uring_write(const char*, int64_t) { return false; }
+int64_t AsyncWriter::uring_complete() { return URING_LOST; }
+#endif
+
+#include <random>
+#include <vector>
+#include <cmath>
+#include <fstream>
+#include <memory>
+
+using namespace std;
+
+int64_t prime = 0, secret = 0;
+bool binary = false; // Шифротекст в двоичном формате (BinaryHeader)
+int64_t width = 0;   // Ширина записи вычета в двоичном формате
+Encoding encoding = Encoding::Number;
+UInt rsa_modulus;       // Модуль RSA (режим --rsa)
+unique_ptr<RsaCrt> crt; // Закрытый ключ RSA
+UInt big_prime, big_secret, big_order; // Параметры ElGamal, если prime не меньше 2^63
+
+
+// Расшифрование пар (c1, c2): m = c2 * (c1^x)^(-1) mod p. Пары обрабатываются параллельно
+// (если parallel), обратные к c1^x в каждом потоке вычисляются разом (batch_inverse).
+vector<int64_t> decrypt_pairs(const vector<int64_t>& c1, const vector<int64_t>& c2, bool parallel = true) {
+    const Montgomery64 mod(prime);
+    vector<int64_t> digits(c1.size());
+    auto body = [&](int64_t begin, int64_t end) {
+        vector<uint64_t> shared(end - begin);
+        for (int64_t i = begin; i < end; ++i) {
+            shared[i-begin] = mod.mont_pow(mod.to_mont(c1[i]), secret);
+        }
+        batch_inverse(mod, shared.data(), end - begin);
+        for (int64_t i = begin; i < end; ++i) {
+            digits[i] = mod.from_mont(mod.mont_mul(mod.to_mont(c2[i]), shared[i-begin]));
+        }
+    };
+    if (parallel) {
+        parallel_for((int64_t)digits.size(), 1024, body);
+    } else {
+        body(0, (int64_t)digits.size());
+    }
+    return digits;
+}
+
+// Пара - шифротекст по модулю prime, только если 0 < c1 < prime и c2 < prime. Проверяется при разборе:
+// c1 = 0 обнулил бы общее произведение в batch_inverse и испортил все обратные своей части.
+bool valid_pair(uint64_t c1, uint64_t c2) {
+    return c1 != 0 && c1 < (uint64_t)prime && c2 < (uint64_t)prime;
+}
+
+// Заголовок блока правдоподобен: pairs записей по record байт помещаются в адресное пространство,
+// а symbols не больше, чем вмещают пары (в паре не больше 11 символов, 64^11 > 2^63; в пустом блоке пар нет)
+bool valid_block(uint64_t symbols, uint64_t pairs, int64_t record) {
+    return pairs <= (uint64_t)INT64_MAX / record && symbols / 11 + (symbols % 11 != 0) <= pairs;
+}
+
+// Упакованный блок из pairs пар вмещает не больше pairs * symbols_per_digit(prime) символов:
+bool fits_packed(int64_t symbols, int64_t pairs) {
+    return encoding != Encoding::Packed || symbols <= pairs * symbols_per_digit(prime);
+}
+
+// Чтение count пар (при count < 0 - до конца ввода). false, если пар меньше count, встретилась
+// недопустимая пара или не число (чтение на них прекращается). count берётся из заголовка, которому
+// нельзя верить, поэтому память заранее не резервируется.
+bool read_pairs(InputSource& in, int64_t count, vector<int64_t>& c1, vector<int64_t>& c2) {
+    c1.clear();
+    c2.clear();
+    uint64_t a, b;
+    while ((count < 0 || (int64_t)c1.size() < count) && in.read_number(a)) {
+        if (!in.read_number(b) || !valid_pair(a, b)) return false;
+        c1.push_back((int64_t)a);
+        c2.push_back((int64_t)b);
+    }
+    string rest;
+    return count < 0 ? !in.read_token(rest) : (int64_t)c1.size() == count;
+}
+
+// Разбор двоичных записей (c1, c2); false, если какая-то пара недопустима (valid_pair):
+bool parse_records(const char* records, int64_t pairs, vector<int64_t>& c1, vector<int64_t>& c2) {
+    c1.resize(pairs);
+    c2.resize(pairs);
+    for (int64_t i = 0; i < pairs; ++i) {
+        const uint64_t a = get_le(records + 2 * width * i, width), b = get_le(records + 2 * width * i + width, width);
+        if (!valid_pair(a, b)) return false;
+        c1[i] = (int64_t)a;
+        c2[i] = (int64_t)b;
+    }
+    return true;
+}
+
+// Заголовок "count size" текстового блока; false, если ввод кончился, а если вместо заголовка
+// не число (или оно обрывается) - ещё и truncated = true
+bool read_block_header(InputSource& in, uint64_t& count, uint64_t& size, bool& truncated) {
+    string rest;
+    if (!in.read_number(count)) {
+        truncated = in.read_token(rest);
+        return false;
+    }
+    truncated = !in.read_number(size);
+    return !truncated;
+}
+
+// Чтение заголовка и пар очередного блока; false, если блоки закончились.
+// Повреждённый (с недопустимой парой) или обрезанный блок также завершает чтение, в этом случае truncated = true.
+bool read_block(InputSource& in, int64_t& symbols, vector<int64_t>& c1, vector<int64_t>& c2, bool& truncated) {
+    truncated = false;
+    if (!binary) {
+        uint64_t count, pairs;
+        if (!read_block_header(in, count, pairs, truncated)) return false;
+        // Пара в тексте занимает не меньше 4 байт ("1 0\n")
+        if (!valid_block(count, pairs, 4) || !fits_packed((int64_t)count, (int64_t)pairs)) {
+            truncated = true;
+            return false;
+        }
+        symbols = (int64_t)count;
+        truncated = !read_pairs(in, (int64_t)pairs, c1, c2);
+        return !truncated;
+    }
+    if (!in.fill(BinaryHeader::BLOCK_HEADER_SIZE)) {
+        truncated = in.available() > 0;
+        return false;
+    }
+    const char* header = in.data();
+    if (string(header, BinaryHeader::BLOCK_HEADER_SIZE) == string(BinaryHeader::BLOCK_HEADER_SIZE, '\xff')) {
+        return false; // Терминатор перед оглавлением контейнера
+    }
+    // Числа заголовка проверяются до чтения и выделения памяти, как и оглавление (read_index):
+    if (!valid_block(get_le(header, 8), get_le(header + 8, 8), 2 * width)
+        || !fits_packed((int64_t)get_le(header, 8), (int64_t)get_le(header + 8, 8))) {
+        truncated = true;
+        return false;
+    }
+    symbols = (int64_t)get_le(header, 8);
+    const int64_t pairs = (int64_t)get_le(header + 8, 8);
+    in.consume(BinaryHeader::BLOCK_HEADER_SIZE);
+    if (!in.fill(2 * width * pairs)) {
+        truncated = true;
+        return false;
+    }
+    if (!parse_records(in.data(), pairs, c1, c2)) {
+        truncated = true;
+        return false;
+    }
+    in.consume(2 * width * pairs);
+    return true;
+}
+
+// Символы блока, закодированного одним числом (symbols < 0 - количество символов неизвестно):
+string decode_block(const vector<int64_t>& digits, int64_t symbols) {
+    if (symbols == 0) return "";
+    auto codes = to_digits(from_digits(digits, prime), 64, max<int64_t>(symbols, 0));
+    string res(codes.size(), ' ');
+    for (size_t i = 0; i < codes.size(); ++i) {
+        res[i] = symbol_char(codes[i]);
+    }
+    return res;
+}
+
+// Символы блока при поблочном кодировании (цифра 0 возможна только при чужом ключе и читается как 1):
+string decode_block_packed(const vector<int64_t>& digits, int64_t symbols) {
+    const int64_t group = symbols_per_digit(prime);
+    string res;
+    res.reserve(min<int64_t>(symbols, (int64_t)digits.size() * group)); // symbols - из заголовка блока
+    for (auto digit : digits) {
+        digit = max<int64_t>(digit, 1) - 1;
+        for (int64_t j = 0; j < group && (int64_t)res.size() < symbols; ++j) {
+            res.push_back(symbol_char(digit % SYMBOLS));
+            digit /= SYMBOLS;
+        }
+    }
+    return res;
+}
+
+string decode(const vector<int64_t>& digits, int64_t symbols) {
+    return encoding == Encoding::Packed ? decode_block_packed(digits, symbols) : decode_block(digits, symbols);
+}
+
+// Расшифрование одного блока контейнера по оглавлению (каждый вызов открывает файл заново,
+// поэтому блоки можно расшифровывать в разных потоках):
+bool decrypt_chunk(const string& path, const ChunkIndex& chunk, string& text) {
+    ifstream file(path, ios::binary);
+    string bytes(chunk.length, '\0');
+    if (chunk.length != BinaryHeader::BLOCK_HEADER_SIZE + 2 * width * chunk.pairs || !fits_packed(chunk.symbols, chunk.pairs)
+        || !file.seekg(chunk.offset) || !file.read(&bytes[0], chunk.length)) return false;
+    vector<int64_t> c1, c2;
+    if (!parse_records(bytes.data() + BinaryHeader::BLOCK_HEADER_SIZE, chunk.pairs, c1, c2)) return false;
+    text = decode(decrypt_pairs(c1, c2, false), chunk.symbols);
+    return true;
+}
+
+// Режим RSA: шифротексты блока расшифровываются параллельно, а если их меньше, чем потоков,
+// в отдельных потоках вычисляются ветви CRT каждого шифротекста.
+vector<UInt> decrypt_values(const vector<UInt>& values) {
+    vector<UInt> res(values.size());
+    const bool branches = (int64_t)values.size() < (int64_t)thread::hardware_concurrency();
+    parallel_for((int64_t)values.size(), 1, [&](int64_t begin, int64_t end) {
+        for (int64_t i = begin; i < end; ++i) {
+            res[i] = crt->decrypt(values[i], branches);
+        }
+    });
+    return res;
+}
+
+// Снятие случайной набивки RSA (см. rsa_symbols): остаются группы символов
+vector<UInt> rsa_unpad(vector<UInt> values) {
+    const UInt place = pow(UInt(SYMBOLS), rsa_symbols(rsa_modulus));
+    for (auto& value : values) value = value % place;
+    return values;
+}
+
+// Расшифрование пар (c1, c2) при длинном prime: m = c2 * c1^(prime - 1 - x) mod prime, а если задан
+// порядок q подгруппы, в которой лежит c1, - m = c2 * c1^(q - x) (пары записаны в values подряд).
+vector<UInt> decrypt_pairs_long(const vector<UInt>& values) {
+    const int64_t count = (int64_t)values.size() / 2;
+    const UInt power = big_order != 0 ? big_order - big_secret : big_prime - 1 - big_secret;
+    vector<UInt> res(count);
+    with_montgomery(big_prime, [&](const auto& engine) {
+        parallel_for(count, 1, [&](int64_t begin, int64_t end) {
+            for (int64_t i = begin; i < end; ++i) {
+                const auto shared = window_pow(engine, engine.to_mont(values[2*i]), power);
+                res[i] = engine.from_mont(engine.mont_mul(engine.to_mont(values[2*i+1]), shared));
+            }
+        });
+    });
+    return res;
+}
+
+// Чтение заголовка и чисел очередного блока RSA или ElGamal с длинным prime (см. read_block),
+// record - количество чисел в одной записи:
+bool read_block_long(InputSource& in, int64_t record, int64_t& symbols, vector<UInt>& values, bool& truncated) {
+    uint64_t count, size;
+    if (!read_block_header(in, count, size, truncated)) return false;
+    // Число в тексте занимает не меньше 2 байт (symbols ограничивает decode_groups)
+    if (count > (uint64_t)INT64_MAX || size > (uint64_t)INT64_MAX / (2 * record)) {
+        truncated = true;
+        return false;
+    }
+    symbols = (int64_t)count;
+    values.clear();
+    string token;
+    while ((int64_t)values.size() < record * (int64_t)size && in.read_token(token) && is_decimal(token)) {
+        values.emplace_back(token);
+    }
+    truncated = (int64_t)values.size() != record * (int64_t)size;
+    return !truncated;
+}
+
+// Символы блока: каждое число - группа из group символов плюс offset (число меньше offset возможно
+// только при чужом ключе и читается как группа из '0')
+string decode_groups(const vector<UInt>& values, int64_t symbols, int64_t group, int64_t offset = 0) {
+    string res;
+    res.reserve(min<int64_t>(symbols, (int64_t)values.size() * group)); // symbols - из заголовка блока
+    for (const UInt& value : values) {
+        for (auto code : to_digits(value < offset ? UInt(0) : value - offset, SYMBOLS, group)) {
+            if ((int64_t)res.size() < symbols) res.push_back(symbol_char(code));
+        }
+    }
+    return res;
+}
+
+// Произведение пар (c1, c2) по модулю prime. Множители не переводятся в форму Монтгомери: каждое
+// умножение mont_mul добавляет множитель R^(-1), так что c1, c2 равны настоящим произведениям count пар,
+// умноженным на R^(-(count - 1)). Поправка вносится один раз в конце (aggregate_result).
+struct PairProduct {
+    uint64_t c1 = 1, c2 = 1;
+    int64_t count = 0;
+};
+
+PairProduct combine(const Montgomery64& mod, const PairProduct& a, const PairProduct& b) {
+    if (a.count == 0) return b;
+    if (b.count == 0) return a;
+    PairProduct res;
+    res.c1 = mod.mont_mul(a.c1, b.c1);
+    res.c2 = mod.mont_mul(a.c2, b.c2);
+    res.count = a.count + b.count;
+    return res;
+}
+
+// Произведение пар [0, size): каждый поток перемножает свой отрезок, частичные произведения
+// попарно объединяются деревом. false, если какой-то вычет не меньше prime.
+bool aggregate_pairs(const Montgomery64& mod, const vector<int64_t>& c1, const vector<int64_t>& c2,
+                     PairProduct& product) {
+    const int64_t size = (int64_t)c1.size();
+    const int64_t parts = max<int64_t>(1, min<int64_t>(thread::hardware_concurrency(), size / 16384));
+    vector<PairProduct> partial(parts);
+    atomic<bool> valid(true);
+    parallel_for(parts, 1, [&](int64_t first, int64_t last) {
+        for (int64_t part = first; part < last; ++part) {
+            PairProduct& res = partial[part];
+            uint64_t a = 1, b = 1;
+            for (int64_t i = size * part / parts; i < size * (part + 1) / parts; ++i) {
+                if ((uint64_t)c1[i] >= mod.mod || (uint64_t)c2[i] >= mod.mod) valid = false;
+                a = res.count == 0 ? c1[i] : mod.mont_mul(a, c1[i]);
+                b = res.count == 0 ? c2[i] : mod.mont_mul(b, c2[i]);
+                ++res.count;
+            }
+            res.c1 = a;
+            res.c2 = b;
+        }
+    });
+    for (int64_t step = 1; step < parts; step *= 2) {
+        for (int64_t i = 0; i + step < parts; i += 2 * step) partial[i] = combine(mod, partial[i], partial[i + step]);
+    }
+    product = combine(mod, product, partial[0]);
+    return valid;
+}
+
+// Настоящее произведение: умножение на R^(count - 1)
+PairProduct aggregate_result(const Montgomery64& mod, PairProduct product) {
+    if (product.count == 0) return product;
+    const uint64_t correction = mod.pow(mod.one(), product.count - 1);
+    product.c1 = mod.mul(product.c1, correction);
+    product.c2 = mod.mul(product.c2, correction);
+    return product;
+}
+
+// Режим --aggregate: покомпонентное произведение всех пар двоичного шифротекста (1.cpp --binary) -
+// шифротекст произведения сообщений под тем же ключом. Закрытый ключ не нужен, prime берётся из
+// заголовка. Пары читаются пачками по AGGREGATE_BATCH и перемножаются параллельно.
+int aggregate_ciphertext(InputSource& in) {
+    const int64_t AGGREGATE_BATCH = 1 << 20;
+    BinaryHeader header;
+    in.fill(BinaryHeader::FIXED_SIZE + 16);
+    if (!header.parse(in.data(), in.available())) {
+        cerr << "Aggregation needs a binary ciphertext (1.cpp --binary)\n";
+        return 1;
+    }
+    in.consume(header.size());
+    binary = true;
+    width = header.width;
+    prime = (int64_t)header.prime;
+    const Montgomery64 mod(prime);
+
+    PairProduct product;
+    vector<int64_t> c1, c2, batch1, batch2;
+    int64_t symbols;
+    bool truncated = false, more = true;
+    while (more) {
+        more = read_block(in, symbols, c1, c2, truncated);
+        batch1.insert(batch1.end(), c1.begin(), c1.end());
+        batch2.insert(batch2.end(), c2.begin(), c2.end());
+        c1.clear();
+        c2.clear();
+        if ((int64_t)batch1.size() >= AGGREGATE_BATCH || !more) {
+            if (!aggregate_pairs(mod, batch1, batch2, product)) {
+                cerr << "Residue is not less than prime\n";
+                return 1;
+            }
+            batch1.clear();
+            batch2.clear();
+        }
+    }
+    if (truncated) {
+        cerr << "Truncated or corrupted ciphertext block\n";
+        return 1;
+    }
+    product = aggregate_result(mod, product);
+    cout << product.c1 << " " << product.c2 << "\n";
+    return 0;
+}
+
+// Гибридный шифротекст (1.cpp --hybrid) после тега "#hybrid": количество слов и их ширина, пары с
+// зашифрованными словами сеансового ключа (слово s записано как s + 1), перевод строки и байты,
+// зашифрованные ChaCha20 до конца ввода. Расшифрованные байты выводятся как есть.
+int decrypt_hybrid(InputSource& in) {
+    uint64_t words = 0, word_bits = 0;
+    if (!in.read_number(words) || !in.read_number(word_bits) || word_bits < 16 || word_bits > 256
+        || (word_bits & (word_bits - 1)) != 0 || words * word_bits != 256) {
+        cerr << "Unknown ciphertext header\n";
+        return 1;
+    }
+    vector<UInt> values;
+    if (big_prime != 0) {
+        string token;
+        while ((uint64_t)values.size() < 2 * words && in.read_token(token) && is_decimal(token)) {
+            values.emplace_back(token);
+        }
+        if (values.size() == 2 * words) values = decrypt_pairs_long(values);
+    } else {
+        vector<int64_t> c1, c2;
+        if (read_pairs(in, (int64_t)words, c1, c2)) {
+            for (auto digit : decrypt_pairs(c1, c2)) values.emplace_back(digit);
+        }
+    }
+    if (values.size() != words || !in.fill(1) || *in.data() != '\n') {
+        cerr << "Truncated or corrupted session key\n";
+        return 1;
+    }
+    in.consume(1);
+
+    std::array<uint32_t, 8> session{};
+    const int64_t pieces = (int64_t)word_bits / 16;
+    for (int64_t i = 0; i < (int64_t)words; ++i) {
+        if (values[i] == 0 || pow(UInt(2), word_bits) < values[i]) {
+            cerr << "Private key does not match the ciphertext key\n";
+            return 1;
+        }
+        const auto digits = to_digits(values[i] - 1, 65536, pieces);
+        for (int64_t j = 0; j < pieces; ++j) {
+            const int64_t piece = i * pieces + j;
+            session[piece / 2] |= (uint32_t)digits[j] << (16 * (piece % 2));
+        }
+    }
+
+    // Куски кратны 64 байтам, как и при шифровании
+    const int64_t CHUNK = 4 << 20;
+    uint64_t offset = 0;
+    string text;
+    while (in.fill(CHUNK) || in.available() > 0) {
+        const int64_t n = min(CHUNK, in.available());
+        text.resize(n);
+        chacha20_xor(session, 0, offset / 64, in.data(), &text[0], n);
+        in.consume(n);
+        offset += n;
+        cout.write(text.data(), n);
+    }
+    cout << flush;
+    return cout ? 0 : 1;
+}
+
+// Расшифровщик: на вход подаются prime и закрытый ключ x (key = g^x mod prime), затем шифротекст,
+// выданный 1.cpp в любом из режимов (текстовом или двоичном). Строку "prime x" для параметров,
+// созданных 1.cpp --genelgamal, выводит он же; при prime >= 2^63 шифротекст только текстовый.
+// Третье число в строке ключа, если есть, - порядок q подгруппы: при длинном prime расшифрование
+// возводит в степень q - x вместо prime - 1 - x.
+// Параметры запуска:
+//   --input FILE  читать шифротекст из файла, а не из стандартного ввода
+//   --chunk I     расшифровать только блок I контейнера (нужен --input)
+//   --rsa         расшифровать вывод 1.cpp --rsa; вместо prime и x задаётся закрытый ключ RSA
+//                 "n d k p1 ... pk" (вторая строка вывода 1.cpp --genrsa)
+//   --aggregate   вместо расшифрования вывести пару "c1 c2" - произведение всех пар двоичного шифротекста
+//                 (aggregate_ciphertext); ключ не задаётся
+//   --numbers     выводить расшифрованные вычеты пар без заголовка десятичными числами по одному в строке
+//                 (например, произведение сообщений после --aggregate)
+// Гибридный шифротекст (1.cpp --hybrid) распознаётся по заголовку "#hybrid" (decrypt_hybrid).
+// Контейнер с оглавлением, заданный через --input, расшифровывается по блокам параллельно.
+int main(int argc, char* argv[]) {
+    ios_base::sync_with_stdio(false);
+    cin.tie(nullptr);
+    string path;
+    int64_t chunk = -1;
+    bool rsa = false, aggregate = false, numbers = false;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--rsa") {
+            rsa = true;
+        } else if (arg == "--aggregate") {
+            aggregate = true;
+        } else if (arg == "--numbers") {
+            numbers = true;
+        } else if (arg == "--input" && i + 1 < argc) {
+            path = argv[++i];
+        } else if (arg == "--chunk" && i + 1 < argc) {
+            chunk = stoll(argv[++i]);
+        } else {
+            cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+
+    if (aggregate) {
+        const int fd = path.empty() ? 0 : open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            cerr << "Cannot open " << path << "\n";
+            return 1;
+        }
+        InputSource in(fd);
+        return aggregate_ciphertext(in);
+    }
+
+    InputSource keys(0);
+    string token[3];
+    if (rsa) {
+        if (!keys.read_token(token[0]) || !keys.read_token(token[1]) || !keys.read_token(token[2])
+            || !is_decimal(token[0]) || !is_decimal(token[1]) || !is_decimal(token[2])) {
+            cerr << "Expected RSA private key n d k p1 ... pk\n";
+            return 1;
+        }
+        rsa_modulus = UInt(token[0]);
+        const UInt d(token[1]);
+        vector<UInt> primes(max<int64_t>(0, atoll(token[2].c_str())));
+        UInt product(1);
+        for (auto& p : primes) {
+            string value;
+            if (!keys.read_token(value) || !is_decimal(value)) break;
+            p = UInt(value);
+            product *= p;
+        }
+        if (primes.size() < 2u || product != rsa_modulus || rsa_symbols(rsa_modulus) == 0) {
+            cerr << "RSA modulus must be the product of at least two listed primes and have more than "
+                 << RSA_PAD_BITS + 7 << " bits\n";
+            return 1;
+        }
+        crt.reset(new RsaCrt(d, primes));
+    } else if (!keys.read_token(token[0]) || !keys.read_token(token[1]) || !is_decimal(token[0]) || !is_decimal(token[1])) {
+        cerr << "Expected prime and private key\n";
+        return 1;
+    } else if (small_value(UInt(token[0])) < 0) {
+        big_prime = UInt(token[0]);
+        big_secret = UInt(token[1]);
+        // Необязательный порядок подгруппы q в той же строке
+        const bool subgroup = keys.read_line_token(token[2]);
+        if (subgroup && !is_decimal(token[2])) {
+            cerr << "Subgroup order must be a decimal number\n";
+            return 1;
+        }
+        big_order = subgroup ? UInt(token[2]) : UInt(0);
+        if (big_prime % 2 == 0 || big_prime % 5 == 0 || big_secret == 0 || big_secret >= big_prime - 1
+            || (big_order != 0 && (big_secret >= big_order || (big_prime - 1) % big_order != 0))) {
+            cerr << "Expected odd prime and private key 0 < x < prime - 1 (x < q for a subgroup of order q)\n";
+            return 1;
+        }
+    } else {
+        prime = small_value(UInt(token[0]));
+        secret = small_value(UInt(token[1]));
+        if (prime <= 3 || prime % 2 == 0 || secret <= 0 || secret >= prime - 1) {
+            cerr << "Expected odd prime > 3 and private key 0 < x < prime - 1\n";
+            return 1;
+        }
+        // Показатель x и так короткий, порядок подгруппы только проверяется
+        const bool subgroup = keys.read_line_token(token[2]);
+        const int64_t order = !subgroup ? prime - 1
+                            : is_decimal(token[2]) ? small_value(UInt(token[2])) : -1;
+        if (order <= 1 || (prime - 1) % order != 0 || secret >= order) {
+            cerr << "Subgroup order q must divide prime - 1 and exceed the private key\n";
+            return 1;
+        }
+    }
+    const int fd = path.empty() ? 0 : open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "Cannot open " << path << "\n";
+        return 1;
+    }
+    unique_ptr<InputSource> file_source(path.empty() ? nullptr : new InputSource(fd));
+    InputSource& in = path.empty() ? keys : *file_source;
+
+    vector<int64_t> c1, c2;
+    if (rsa || big_prime != 0) {
+        // Текстовый шифротекст из длинных чисел: "#rsa N" или "#blocks N packed"
+        string tag, size, name = "packed";
+        if (!rsa && in.read_token(tag) && tag == "#hybrid") return decrypt_hybrid(in);
+        if ((rsa && !in.read_token(tag)) || !in.read_token(size) || tag != (rsa ? "#rsa" : "#blocks")
+            || (!rsa && !in.read_token(name)) || name != "packed") {
+            cerr << "Unknown ciphertext header\n";
+            return 1;
+        }
+        const int64_t block_size = atoll(size.c_str());
+        int64_t symbols;
+        vector<UInt> values;
+        bool truncated = false;
+        const int64_t group = rsa ? rsa_symbols(rsa_modulus) : symbols_per_value(big_prime, SYMBOLS);
+        while (read_block_long(in, rsa ? 1 : 2, symbols, values, truncated)) {
+            if (symbols > (int64_t)values.size() / (rsa ? 1 : 2) * group) { // Больше, чем вмещает блок
+                truncated = true;
+                break;
+            }
+            if (rsa) {
+                cout << decode_groups(rsa_unpad(decrypt_values(values)), symbols, group);
+            } else {
+                cout << decode_groups(decrypt_pairs_long(values), symbols, group, 1);
+            }
+            if (block_size > 0) cout << flush;
+        }
+        if (truncated) {
+            cerr << "Truncated or corrupted ciphertext block\n";
+            return 1;
+        }
+        if (block_size == 0) cout << "\n";
+        return 0;
+    }
+    while ((in.available() > 0 || in.fill(1)) && isspace((unsigned char)*in.data())) in.consume(1);
+    const char first = in.available() > 0 ? *in.data() : '\0';
+    if (first != '#' && first != 'E') {
+        // Старый формат: только пары, всё сообщение - одно число
+        if (!read_pairs(in, -1, c1, c2)) {
+            cerr << "Malformed ciphertext: expected decimal pairs with 0 < c1 < prime, c2 < prime\n";
+            return 1;
+        }
+        if (numbers) {
+            for (auto digit : decrypt_pairs(c1, c2)) cout << digit << "\n";
+            return 0;
+        }
+        cout << decode_block(decrypt_pairs(c1, c2), -1) << "\n";
+        return 0;
+    }
+
+    int64_t block_size = 0;
+    uint8_t flags = 0;
+    if (first == '#') {
+        string tag, size, name;
+        in.read_token(tag);
+        if (tag == "#hybrid") return decrypt_hybrid(in);
+        in.read_token(size);
+        in.read_token(name);
+        block_size = atoll(size.c_str());
+        if (tag != "#blocks" || (name != "number" && name != "packed")) {
+            cerr << "Unknown ciphertext header\n";
+            return 1;
+        }
+        encoding = name == "packed" ? Encoding::Packed : Encoding::Number;
+    } else {
+        BinaryHeader header;
+        in.fill(BinaryHeader::FIXED_SIZE + 16);
+        if (!header.parse(in.data(), in.available()) || (int64_t)header.prime != prime) {
+            cerr << "Unknown ciphertext header or different prime\n";
+            return 1;
+        }
+        // Идентификатор ключа из заголовка должен совпасть с идентификатором g^x
+        if (header.key != key_id(Montgomery64(prime).pow(header.g, secret), header.width)) {
+            cerr << "Private key does not match the ciphertext key\n";
+            return 1;
+        }
+        in.consume(header.size());
+        binary = true;
+        width = header.width;
+        block_size = header.block_size;
+        encoding = header.encoding;
+        flags = header.flags;
+    }
+    if (encoding == Encoding::Packed && symbols_per_digit(prime) == 0) {
+        cerr << "Packed encoding needs prime > " << SYMBOLS + 1 << "\n";
+        return 1;
+    }
+
+    if ((flags & BinaryHeader::INDEXED) && !path.empty()) {
+        vector<ChunkIndex> index;
+        ifstream file(path, ios::binary);
+        if (!read_index(file, index) || chunk >= (int64_t)index.size()) {
+            cerr << "Broken container index or no such chunk\n";
+            return 1;
+        }
+        const int64_t first = chunk >= 0 ? chunk : 0;
+        const int64_t last = chunk >= 0 ? chunk + 1 : (int64_t)index.size();
+        // Блоки обрабатываются волнами, чтобы в памяти одновременно находилось ограниченное число блоков
+        const int64_t wave = 4 * max<int64_t>(1, thread::hardware_concurrency());
+        for (int64_t start = first; start < last; start += wave) {
+            const int64_t count = min(wave, last - start);
+            vector<string> texts(count);
+            vector<char> ok(count);
+            parallel_for(count, 1, [&](int64_t begin, int64_t end) {
+                for (int64_t i = begin; i < end; ++i) {
+                    ok[i] = decrypt_chunk(path, index[start + i], texts[i]);
+                }
+            });
+            for (int64_t i = 0; i < count; ++i) {
+                if (!ok[i]) {
+                    cerr << "Broken chunk " << start + i << "\n";
+                    return 1;
+                }
+                cout << texts[i];
+            }
+            cout << flush;
+        }
+        return 0;
+    }
+    if (chunk >= 0) {
+        cerr << "--chunk needs an indexed container given with --input\n";
+        return 1;
+    }
+
+    int64_t symbols;
+    bool truncated = false;
+    while (read_block(in, symbols, c1, c2, truncated)) {
+        cout << decode(decrypt_pairs(c1, c2), symbols);
+        if (block_size > 0) cout << flush;
+    }
+    if (truncated) {
+        cerr << "Truncated or corrupted ciphertext block\n";
+        return 1;
+    }
+    if (block_size == 0) cout << "\n";
     return 0;
 }